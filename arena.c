@@ -0,0 +1,189 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the arena allocator and the pool of interned strings
+
+    An arena hands out memory from large chunks and releases everything at once,
+    so objects that live until the end of a run cost neither a malloc() nor a free().
+    The pool keeps one copy of every string in an open addressing hash table;
+    interned strings are equal if and only if their pointers are equal.
+*/
+
+#include "arena.h"
+#include "hash.h"
+#include "allocator.h"
+
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT sizeof(void*)
+
+typedef struct arena_chunk_t arena_chunk_t;
+
+struct arena_chunk_t
+{
+    arena_chunk_t *next;
+    size_t size;
+    size_t used;
+};
+
+struct arena_t
+{
+    arena_chunk_t *chunk;
+};
+
+struct string_pool_t
+{
+    arena_t *arena;
+    string_t **table;
+    size_t capacity;
+    size_t count;
+};
+
+arena_t * create_arena()
+{
+    arena_t *arena = nnalloc(sizeof(arena_t));
+    arena->chunk = NULL;
+    return arena;
+}
+
+void * allocate_from_arena(arena_t *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    arena_chunk_t *chunk = arena->chunk;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+        chunk = nnalloc(sizeof(arena_chunk_t) + chunk_size);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        if (chunk_size == size && arena->chunk)
+        {
+            // a big block goes behind the current chunk, so the rest of that chunk is still in use
+            chunk->next = arena->chunk->next;
+            arena->chunk->next = chunk;
+        }
+        else
+        {
+            chunk->next = arena->chunk;
+            arena->chunk = chunk;
+        }
+    }
+    void *block = (char*)(chunk + 1) + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+static string_t * create_string_in_arena(arena_t *arena, size_t length)
+{
+    string_t *str = allocate_from_arena(arena, sizeof(string_t) + length + 1);
+    str->data = (char*)(str + 1);
+    str->length = length;
+    str->data[length] = '\0';
+    return str;
+}
+
+string_t * copy_string_to_arena(arena_t *arena, string_t str)
+{
+    string_t *copy = create_string_in_arena(arena, str.length);
+    memcpy(copy->data, str.data, str.length);
+    return copy;
+}
+
+void destroy_arena(arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->chunk;
+    while (chunk)
+    {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+string_pool_t * create_string_pool(arena_t *arena)
+{
+    string_pool_t *pool = nnalloc(sizeof(string_pool_t));
+    pool->arena = arena;
+    pool->capacity = 1024;
+    pool->count = 0;
+    pool->table = nnalloc(sizeof(string_t*) * pool->capacity);
+    memset(pool->table, 0, sizeof(string_t*) * pool->capacity);
+    return pool;
+}
+
+static void grow_string_pool(string_pool_t *pool)
+{
+    size_t capacity = pool->capacity * 2;
+    string_t **table = nnalloc(sizeof(string_t*) * capacity);
+    memset(table, 0, sizeof(string_t*) * capacity);
+    for (size_t i = 0; i < pool->capacity; i++)
+    {
+        string_t *str = pool->table[i];
+        if (!str)
+            continue;
+        size_t index = (size_t)calculate_hash(initial_hash_value, str->data, str->length) & (capacity - 1);
+        while (table[index])
+            index = (index + 1) & (capacity - 1);
+        table[index] = str;
+    }
+    free(pool->table);
+    pool->table = table;
+    pool->capacity = capacity;
+}
+
+static bool string_consists_of_parts(const string_t *str, const string_t *parts, size_t count)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (memcmp(str->data + offset, parts[i].data, parts[i].length) != 0)
+            return false;
+        offset += parts[i].length;
+    }
+    return true;
+}
+
+string_t * intern_concatenated_strings(string_pool_t *pool, const string_t *parts, size_t count)
+{
+    uint64_t hash = initial_hash_value;
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        hash = calculate_hash(hash, parts[i].data, parts[i].length);
+        length += parts[i].length;
+    }
+    size_t index = (size_t)hash & (pool->capacity - 1);
+    string_t *str;
+    while ((str = pool->table[index]) != NULL)
+    {
+        if (str->length == length && string_consists_of_parts(str, parts, count))
+            return str;
+        index = (index + 1) & (pool->capacity - 1);
+    }
+
+    str = create_string_in_arena(pool->arena, length);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(str->data + offset, parts[i].data, parts[i].length);
+        offset += parts[i].length;
+    }
+    pool->table[index] = str;
+    pool->count++;
+    if (pool->count * 2 > pool->capacity)
+        grow_string_pool(pool);
+    return str;
+}
+
+string_t * intern_string(string_pool_t *pool, string_t str)
+{
+    return intern_concatenated_strings(pool, &str, 1);
+}
+
+void destroy_string_pool(string_pool_t *pool)
+{
+    free(pool->table);
+    free(pool);
+}
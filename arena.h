@@ -0,0 +1,22 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the arena allocator and the pool of interned strings
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct arena_t arena_t;
+typedef struct string_pool_t string_pool_t;
+
+arena_t * create_arena();
+void * allocate_from_arena(arena_t *arena, size_t size);
+string_t * copy_string_to_arena(arena_t *arena, string_t str);
+void destroy_arena(arena_t *arena);
+
+string_pool_t * create_string_pool(arena_t *arena);
+string_t * intern_string(string_pool_t *pool, string_t str);
+string_t * intern_concatenated_strings(string_pool_t *pool, const string_t *parts, size_t count);
+void destroy_string_pool(string_pool_t *pool);
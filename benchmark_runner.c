@@ -0,0 +1,423 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the runner that measures benchmark projects and compares them with a baseline
+
+    A benchmark reports its measurements to the standard output, one per line:
+    'BENCHMARK <name> <value>', where a smaller value is better; other lines are
+    ignored. A benchmark that reports nothing is measured by its wall time.
+
+    Benchmarks run one after another, pinned to one processor, after some warmup
+    runs that are not measured. Samples of every measurement are compared with the
+    samples kept in the baseline file by Welch's t-test, and a measurement that has
+    become slower with a high confidence is a regression. Measurements that are not
+    in the baseline yet are added to it.
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "benchmark_runner.h"
+#include "tree_map.h"
+#include "files.h"
+#include "process.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+static const char *measurement_prefix = "BENCHMARK ";
+
+/*
+    A slowdown must be both significant and large enough to matter
+*/
+static const double significance_level = 0.01;
+static const double minimal_regression = 0.02;
+
+typedef struct
+{
+    string_t *name;
+    double *values;
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+benchmark_descriptor_t * create_benchmark_descriptor(string_t *name, string_t *exe_file, string_t *log_file,
+        string_t *baseline_file, double timeout, size_t runs, size_t warmup_runs)
+{
+    benchmark_descriptor_t *benchmark = nnalloc(sizeof(benchmark_descriptor_t));
+    benchmark->name = name;
+    benchmark->exe_file = exe_file;
+    benchmark->log_file = log_file;
+    benchmark->baseline_file = baseline_file;
+    benchmark->timeout = timeout;
+    benchmark->runs = runs;
+    benchmark->warmup_runs = warmup_runs;
+    return benchmark;
+}
+
+void destroy_benchmark_descriptor(benchmark_descriptor_t *benchmark)
+{
+    free(benchmark->name);
+    free(benchmark->exe_file);
+    free(benchmark->log_file);
+    free(benchmark->baseline_file);
+    free(benchmark);
+}
+
+static samples_t * get_samples(tree_map_t *measurements, string_t name)
+{
+    const pair_t *pair = get_pair_from_tree_map(measurements, &name);
+    if (pair)
+        return (samples_t*)pair->value;
+    samples_t *samples = nnalloc(sizeof(samples_t));
+    samples->name = duplicate_string(name);
+    samples->count = 0;
+    samples->capacity = 16;
+    samples->values = nnalloc(sizeof(double) * samples->capacity);
+    add_pair_to_tree_map(measurements, samples->name, samples);
+    return samples;
+}
+
+static void add_sample(samples_t *samples, double value)
+{
+    if (samples->count == samples->capacity)
+    {
+        double *values = nnalloc(sizeof(double) * samples->capacity * 2);
+        memcpy(values, samples->values, sizeof(double) * samples->count);
+        free(samples->values);
+        samples->values = values;
+        samples->capacity *= 2;
+    }
+    samples->values[samples->count++] = value;
+}
+
+static void destroy_samples(samples_t *samples)
+{
+    free(samples->name);
+    free(samples->values);
+    free(samples);
+}
+
+static tree_map_t * read_baseline(string_t *baseline_file)
+{
+    tree_map_t *baseline = create_tree_map((void*)compare_strings);
+    string_t *content = read_file_to_string(baseline_file->data);
+    if (!content)
+        return baseline;
+    // lines are '<name> <value> <value>...'
+    char *line = content->data;
+    while (*line)
+    {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end = '\0';
+        char *space = strchr(line, ' ');
+        if (space)
+        {
+            samples_t *samples = get_samples(baseline, (string_t){ line, space - line });
+            char *next = space;
+            while (true)
+            {
+                char *value_end;
+                double value = strtod(next, &value_end);
+                if (value_end == next)
+                    break;
+                add_sample(samples, value);
+                next = value_end;
+            }
+        }
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    free(content);
+    return baseline;
+}
+
+static void write_baseline(string_t *baseline_file, tree_map_t *baseline)
+{
+    FILE *stream = fopen(baseline_file->data, "w");
+    if (!stream)
+    {
+        fprintf(stderr, "Couldn't write the baseline '%s'\n", baseline_file->data);
+        return;
+    }
+    map_iterator_t *iter = create_iterator_from_tree_map(baseline);
+    while (has_next_pair(iter))
+    {
+        samples_t *samples = (samples_t*)next_pair(iter)->value;
+        fprintf(stream, "%s", samples->name->data);
+        for (size_t i = 0; i < samples->count; i++)
+            fprintf(stream, " %.9g", samples->values[i]);
+        fprintf(stream, "\n");
+    }
+    destroy_map_iterator(iter);
+    fclose(stream);
+}
+
+static bool read_measurements(benchmark_descriptor_t *benchmark, tree_map_t *measurements)
+{
+    string_t *content = read_file_to_string(benchmark->log_file->data);
+    if (!content)
+        return false;
+    size_t prefix_length = strlen(measurement_prefix);
+    bool found = false;
+    char *line = content->data;
+    while (*line)
+    {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end = '\0';
+        if (0 == strncmp(line, measurement_prefix, prefix_length))
+        {
+            char *name = line + prefix_length;
+            char *space = strchr(name, ' ');
+            char *value_end;
+            double value = space ? strtod(space, &value_end) : 0;
+            if (space && value_end != space)
+            {
+                string_t *full_name = create_formatted_string("%S.%S", *benchmark->name,
+                    (string_t){ name, space - name });
+                add_sample(get_samples(measurements, *full_name), value);
+                free(full_name);
+                found = true;
+            }
+        }
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    free(content);
+    return found;
+}
+
+/*
+    The last processor is the least likely to serve interrupts
+*/
+#if defined(__linux__)
+
+typedef cpu_set_t affinity_t;
+
+static bool pin_to_processor(affinity_t *previous)
+{
+    if (sched_getaffinity(0, sizeof(affinity_t), previous) != 0)
+        return false;
+    int processor = -1;
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        if (CPU_ISSET(i, previous))
+            processor = i;
+    }
+    if (processor < 0)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(processor, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+static void unpin(affinity_t *previous)
+{
+    sched_setaffinity(0, sizeof(affinity_t), previous);
+}
+
+#else
+
+typedef int affinity_t;
+
+static bool pin_to_processor(affinity_t *previous)
+{
+    return false;
+}
+
+static void unpin(affinity_t *previous)
+{
+}
+
+#endif
+
+static bool run_benchmark(benchmark_descriptor_t *benchmark, tree_map_t *measurements)
+{
+    size_t total_runs = benchmark->warmup_runs + benchmark->runs;
+    for (size_t i = 0; i < total_runs; i++)
+    {
+        bool timed_out;
+        double start_time = get_current_time();
+        int result = execute_command_with_timeout(benchmark->exe_file->data, NULL, benchmark->log_file->data,
+            benchmark->timeout, &timed_out);
+        double duration = get_current_time() - start_time;
+        if (timed_out || result != 0)
+        {
+            printf("[%s] %s, see '%s'\n", timed_out ? "TIMEOUT" : "FAILED", benchmark->name->data,
+                benchmark->log_file->data);
+            return false;
+        }
+        if (i >= benchmark->warmup_runs && !read_measurements(benchmark, measurements))
+            add_sample(get_samples(measurements, *benchmark->name), duration);
+    }
+    return true;
+}
+
+static double calculate_mean(samples_t *samples)
+{
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++)
+        sum += samples->values[i];
+    return sum / samples->count;
+}
+
+static double calculate_variance(samples_t *samples, double mean)
+{
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++)
+        sum += (samples->values[i] - mean) * (samples->values[i] - mean);
+    return samples->count > 1 ? sum / (samples->count - 1) : 0;
+}
+
+/*
+    The continued fraction of the regularized incomplete beta function (modified Lentz's method)
+*/
+static double calculate_beta_fraction(double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    d = 1 / (fabs(d) < tiny ? tiny : d);
+    double result = d;
+    for (int m = 1; m <= 200; m++)
+    {
+        double numerator = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1 + numerator * d;
+        d = 1 / (fabs(d) < tiny ? tiny : d);
+        c = 1 + numerator / c;
+        c = fabs(c) < tiny ? tiny : c;
+        result *= d * c;
+        numerator = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + numerator * d;
+        d = 1 / (fabs(d) < tiny ? tiny : d);
+        c = 1 + numerator / c;
+        c = fabs(c) < tiny ? tiny : c;
+        double delta = d * c;
+        result *= delta;
+        if (fabs(delta - 1) < 1e-12)
+            break;
+    }
+    return result;
+}
+
+static double calculate_incomplete_beta(double a, double b, double x)
+{
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2))
+        return front * calculate_beta_fraction(a, b, x) / a;
+    return 1 - front * calculate_beta_fraction(b, a, 1 - x) / b;
+}
+
+/*
+    The two-sided p-value of Welch's t-test, which does not assume equal variances
+*/
+static double calculate_p_value(samples_t *first, samples_t *second)
+{
+    if (first->count < 2 || second->count < 2)
+        return 1;
+    double first_mean = calculate_mean(first);
+    double second_mean = calculate_mean(second);
+    double first_error = calculate_variance(first, first_mean) / first->count;
+    double second_error = calculate_variance(second, second_mean) / second->count;
+    double error = first_error + second_error;
+    if (error == 0)
+        return first_mean == second_mean ? 1 : 0;
+    double t = (first_mean - second_mean) / sqrt(error);
+    double freedom = error * error / (first_error * first_error / (first->count - 1)
+        + second_error * second_error / (second->count - 1));
+    return calculate_incomplete_beta(freedom / 2, 0.5, freedom / (freedom + t * t));
+}
+
+static bool compare_with_baseline(tree_map_t *measurements, tree_map_t *baseline, bool *baseline_changed)
+{
+    bool result = true;
+    map_iterator_t *iter = create_iterator_from_tree_map(measurements);
+    while (has_next_pair(iter))
+    {
+        samples_t *samples = (samples_t*)next_pair(iter)->value;
+        double mean = calculate_mean(samples);
+        double deviation = sqrt(calculate_variance(samples, mean));
+        const pair_t *pair = get_pair_from_tree_map(baseline, samples->name);
+        if (!pair)
+        {
+            printf("[NEW]      %s %.6g +/- %.1f%%, added to the baseline\n", samples->name->data, mean,
+                mean ? 100 * deviation / mean : 0);
+            samples_t *copy = get_samples(baseline, *samples->name);
+            for (size_t i = 0; i < samples->count; i++)
+                add_sample(copy, samples->values[i]);
+            *baseline_changed = true;
+            continue;
+        }
+        samples_t *base = (samples_t*)pair->value;
+        double base_mean = calculate_mean(base);
+        double change = base_mean ? (mean - base_mean) / base_mean : 0;
+        double p_value = calculate_p_value(samples, base);
+        const char *status = "[OK]     ";
+        if (p_value < significance_level && change > minimal_regression)
+        {
+            status = "[SLOWER] ";
+            result = false;
+        }
+        else if (p_value < significance_level && change < -minimal_regression)
+        {
+            status = "[FASTER] ";
+        }
+        printf("%s %s %.6g +/- %.1f%%, baseline %.6g, %+.1f%%, p = %.3f\n", status, samples->name->data, mean,
+            mean ? 100 * deviation / mean : 0, base_mean, 100 * change, p_value);
+    }
+    destroy_map_iterator(iter);
+    return result;
+}
+
+bool run_benchmarks(vector_t *benchmark_list)
+{
+    size_t count = benchmark_list->size;
+    if (!count)
+        return true;
+    printf("\n> Running %d benchmark(s)...\n", (int)count);
+    affinity_t affinity;
+    bool pinned = pin_to_processor(&affinity);
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        benchmark_descriptor_t *benchmark = (benchmark_descriptor_t*)benchmark_list->data[i];
+        tree_map_t *measurements = create_tree_map((void*)compare_strings);
+        if (run_benchmark(benchmark, measurements))
+        {
+            tree_map_t *baseline = read_baseline(benchmark->baseline_file);
+            bool baseline_changed = false;
+            if (!compare_with_baseline(measurements, baseline, &baseline_changed))
+                failed++;
+            if (baseline_changed)
+                write_baseline(benchmark->baseline_file, baseline);
+            destroy_tree_map_and_content(baseline, NULL, (void*)destroy_samples);
+        }
+        else
+        {
+            failed++;
+        }
+        destroy_tree_map_and_content(measurements, NULL, (void*)destroy_samples);
+    }
+    if (pinned)
+        unpin(&affinity);
+    if (failed)
+        printf("%d of %d benchmark(s) failed or regressed\n", (int)failed, (int)count);
+    return failed == 0;
+}
@@ -0,0 +1,26 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the runner that measures benchmark projects and compares them with a baseline
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+typedef struct
+{
+    string_t *name;
+    string_t *exe_file;
+    string_t *log_file;
+    string_t *baseline_file;
+    double timeout;
+    size_t runs;
+    size_t warmup_runs;
+} benchmark_descriptor_t;
+
+benchmark_descriptor_t * create_benchmark_descriptor(string_t *name, string_t *exe_file, string_t *log_file,
+        string_t *baseline_file, double timeout, size_t runs, size_t warmup_runs);
+void destroy_benchmark_descriptor(benchmark_descriptor_t *benchmark);
+bool run_benchmarks(vector_t *benchmark_list);
@@ -0,0 +1,377 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the history of compile and link durations and output sizes
+
+    The history is a text file that is only appended to: each build that has run
+    any step adds the line 'build <time>' followed by a line per step,
+    '<c|b|l> <duration> <size> <name>', where the name is the source file of a compile step
+    and the output file of a link step. Sources compiled in a batch ('b') get an equal
+    share of the batch duration; it is an estimate, which counts in the total compile time,
+    but is not compared with durations of other builds unit by unit. Steps that were up to date are not recorded,
+    so the state after a build is the latest record of every unit up to that build.
+    The report compares the state after the last build with the state after the previous
+    build, or after the last build older than the given number of days, and lists units
+    that became slower or bigger. The total compile time is the sum over all units,
+    that is, the expected duration of a full build on one core.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "build_history.h"
+#include "tree_map.h"
+#include "vector.h"
+#include "files.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+    Durations jitter from build to build, smaller changes are not reported
+*/
+#define MIN_RELATIVE_SLOWDOWN 0.1
+#define MIN_ABSOLUTE_SLOWDOWN 0.05
+
+static const char step_kind_names[] = { 'c', 'b', 'l' };
+
+struct build_history_t
+{
+    string_t *file_name;
+    string_builder_t *records;
+    pthread_mutex_t mutex;
+};
+
+build_history_t * open_build_history(string_t *file_name)
+{
+    build_history_t *history = nnalloc(sizeof(build_history_t));
+    history->file_name = duplicate_string(*file_name);
+    history->records = NULL;
+    pthread_mutex_init(&history->mutex, NULL);
+    return history;
+}
+
+static size_t get_file_size(const char *file_name)
+{
+    struct stat info;
+    return stat(file_name, &info) == 0 ? (size_t)info.st_size : 0;
+}
+
+void record_build_step(build_history_t *history, build_step_kind_t kind, string_t *name, string_t *output_file,
+        double duration)
+{
+    size_t size = get_file_size(output_file->data);
+    pthread_mutex_lock(&history->mutex);
+    history->records = append_formatted_string(history->records, "%c %.3f %d %S\n", step_kind_names[kind],
+        duration, (int)size, *name);
+    pthread_mutex_unlock(&history->mutex);
+}
+
+void save_build_history(build_history_t *history)
+{
+    pthread_mutex_lock(&history->mutex);
+    FILE *stream = history->records ? fopen(history->file_name->data, "a") : NULL;
+    if (stream)
+    {
+        string_t *records = (string_t*)history->records;
+        fprintf(stream, "build %lld\n", (long long)time(NULL));
+        fwrite(records->data, 1, records->length, stream);
+        fclose(stream);
+        free(history->records);
+        history->records = NULL;
+    }
+    pthread_mutex_unlock(&history->mutex);
+}
+
+void destroy_build_history(build_history_t *history)
+{
+    pthread_mutex_destroy(&history->mutex);
+    free(history->records);
+    free(history->file_name);
+    free(history);
+}
+
+typedef struct
+{
+    build_step_kind_t kind;
+    string_t *name;
+    double duration;
+    size_t size;
+} step_record_t;
+
+typedef struct
+{
+    long long time;
+    vector_t *steps;
+} build_record_t;
+
+static void destroy_step_record(step_record_t *step)
+{
+    free(step->name);
+    free(step);
+}
+
+static void destroy_build_record(build_record_t *build)
+{
+    destroy_vector_and_content(build->steps, (void*)destroy_step_record);
+    free(build);
+}
+
+static step_record_t * parse_step_record(string_t line)
+{
+    if (line.length < 2 || line.data[1] != ' ')
+        return NULL;
+    build_step_kind_t kind = build_step_compile;
+    while (kind <= build_step_link && line.data[0] != step_kind_names[kind])
+        kind++;
+    if (kind > build_step_link)
+        return NULL;
+    double duration;
+    unsigned long long size;
+    int name_offset = 0;
+    if (sscanf(line.data + 2, "%lf %llu %n", &duration, &size, &name_offset) != 2 || name_offset == 0)
+        return NULL;
+    string_t name = { line.data + 2 + name_offset, line.length - 2 - (size_t)name_offset };
+    if (name.length == 0)
+        return NULL;
+    step_record_t *step = nnalloc(sizeof(step_record_t));
+    step->kind = kind;
+    step->name = duplicate_string(name);
+    step->duration = duration;
+    step->size = (size_t)size;
+    return step;
+}
+
+/*
+    Lines that can't be parsed, like the tail of a build that was interrupted
+    while the file was written, are skipped
+*/
+static vector_t * load_build_records(const char *file_name)
+{
+    string_t *content = read_file_to_string(file_name);
+    if (!content)
+        return NULL;
+    vector_t *builds = create_vector();
+    build_record_t *build = NULL;
+    size_t index = 0;
+    while (index < content->length)
+    {
+        size_t end = index;
+        while (end < content->length && content->data[end] != '\n')
+            end++;
+        content->data[end] = '\0';
+        string_t line = { content->data + index, end - index };
+        index = end + 1;
+        long long time;
+        if (sscanf(line.data, "build %lld", &time) == 1)
+        {
+            build = nnalloc(sizeof(build_record_t));
+            build->time = time;
+            build->steps = create_vector();
+            add_item_to_vector(builds, build);
+            continue;
+        }
+        step_record_t *step = build ? parse_step_record(line) : NULL;
+        if (step)
+            add_item_to_vector(build->steps, step);
+    }
+    free(content);
+    return builds;
+}
+
+/*
+    The latest record of every unit up to the given build, including it
+*/
+static tree_map_t * create_build_state(vector_t *builds, size_t count)
+{
+    tree_map_t *state = create_tree_map((void*)compare_strings);
+    for (size_t i = count; i > 0; i--)
+    {
+        build_record_t *build = (build_record_t*)builds->data[i - 1];
+        for (size_t j = build->steps->size; j > 0; j--)
+        {
+            step_record_t *step = (step_record_t*)build->steps->data[j - 1];
+            if (!get_pair_from_tree_map(state, step->name))
+                add_pair_to_tree_map(state, step->name, step);
+        }
+    }
+    return state;
+}
+
+typedef struct
+{
+    double compile_time;
+    double link_time;
+    size_t size;
+    size_t units;
+} build_totals_t;
+
+static build_totals_t calculate_build_totals(tree_map_t *state)
+{
+    build_totals_t totals = { 0, 0, 0, 0 };
+    map_iterator_t *iter = create_iterator_from_tree_map(state);
+    while (has_next_pair(iter))
+    {
+        step_record_t *step = (step_record_t*)next_pair(iter)->value;
+        if (step->kind != build_step_link)
+        {
+            totals.compile_time += step->duration;
+            totals.units++;
+        }
+        else
+        {
+            totals.link_time += step->duration;
+        }
+        totals.size += step->size;
+    }
+    destroy_map_iterator(iter);
+    return totals;
+}
+
+typedef struct
+{
+    step_record_t *before;
+    step_record_t *after;
+} step_change_t;
+
+static int compare_step_changes(const void *first, const void *second)
+{
+    const step_change_t *first_change = *((const step_change_t**)first);
+    const step_change_t *second_change = *((const step_change_t**)second);
+    double first_delta = first_change->after->duration - first_change->before->duration;
+    double second_delta = second_change->after->duration - second_change->before->duration;
+    if (first_delta != second_delta)
+        return first_delta > second_delta ? -1 : 1;
+    return compare_strings(first_change->after->name, second_change->after->name);
+}
+
+static bool is_step_slower(step_record_t *before, step_record_t *after)
+{
+    if (before->kind == build_step_batched_compile || after->kind == build_step_batched_compile)
+        return false;
+    double delta = after->duration - before->duration;
+    return delta >= MIN_ABSOLUTE_SLOWDOWN && delta >= before->duration * MIN_RELATIVE_SLOWDOWN;
+}
+
+static vector_t * create_list_of_step_changes(tree_map_t *before, tree_map_t *after, size_t *new_units)
+{
+    vector_t *list = create_vector();
+    *new_units = 0;
+    map_iterator_t *iter = create_iterator_from_tree_map(after);
+    while (has_next_pair(iter))
+    {
+        step_record_t *step = (step_record_t*)next_pair(iter)->value;
+        const pair_t *pair = get_pair_from_tree_map(before, step->name);
+        if (!pair)
+        {
+            (*new_units)++;
+            continue;
+        }
+        step_record_t *previous = (step_record_t*)pair->value;
+        if (previous != step && (is_step_slower(previous, step) || step->size > previous->size))
+        {
+            step_change_t *change = nnalloc(sizeof(step_change_t));
+            change->before = previous;
+            change->after = step;
+            add_item_to_vector(list, change);
+        }
+    }
+    destroy_map_iterator(iter);
+    qsort(list->data, list->size, sizeof(void*), compare_step_changes);
+    return list;
+}
+
+static double calculate_relative_change(double before, double after)
+{
+    return before > 0 ? 100.0 * (after - before) / before : 0.0;
+}
+
+static void format_build_time(long long time, char *buff, size_t size)
+{
+    time_t value = (time_t)time;
+    struct tm *tm = localtime(&value);
+    if (!tm || !strftime(buff, size, "%Y-%m-%d %H:%M:%S", tm))
+        snprintf(buff, size, "%lld", time);
+}
+
+/*
+    Returns false only if the total compile time exceeds the limit, so the report can gate CI
+*/
+bool print_build_history_report(string_t *file_name, double window_days, double compile_time_limit)
+{
+    vector_t *builds = load_build_records(file_name->data);
+    if (!builds || builds->size == 0)
+    {
+        printf("\n> The build history '%s' is empty\n", file_name->data);
+        if (builds)
+            destroy_vector(builds);
+        return true;
+    }
+
+    // the baseline is the number of builds that make up the earlier state
+    size_t baseline = builds->size - 1;
+    if (window_days > 0)
+    {
+        long long start = (long long)time(NULL) - (long long)(window_days * 86400);
+        baseline = 0;
+        while (baseline < builds->size && ((build_record_t*)builds->data[baseline])->time < start)
+            baseline++;
+    }
+    tree_map_t *before = create_build_state(builds, baseline);
+    tree_map_t *after = create_build_state(builds, builds->size);
+    build_totals_t totals_before = calculate_build_totals(before);
+    build_totals_t totals_after = calculate_build_totals(after);
+    size_t new_units;
+    vector_t *changes = create_list_of_step_changes(before, after, &new_units);
+
+    char time_before[32] = "the beginning", time_after[32];
+    if (baseline > 0)
+        format_build_time(((build_record_t*)builds->data[baseline - 1])->time, time_before, sizeof(time_before));
+    format_build_time(((build_record_t*)builds->data[builds->size - 1])->time, time_after, sizeof(time_after));
+    printf("\n> Build history of %d build(s), changes from %s to %s:\n", (int)builds->size, time_before, time_after);
+    if (changes->size)
+    {
+        printf("%10s %10s %8s %12s %12s %8s  %s\n", "before, s", "after, s", "change", "size before",
+            "size after", "change", "unit");
+        for (size_t i = 0; i < changes->size; i++)
+        {
+            step_change_t *change = (step_change_t*)changes->data[i];
+            printf("%10.3f %10.3f %+7.1f%% %12d %12d %+7.1f%%  %s\n",
+                change->before->duration, change->after->duration,
+                calculate_relative_change(change->before->duration, change->after->duration),
+                (int)change->before->size, (int)change->after->size,
+                calculate_relative_change((double)change->before->size, (double)change->after->size),
+                change->after->name->data);
+        }
+    }
+    else
+    {
+        printf("No unit became slower or bigger\n");
+    }
+    if (new_units)
+        printf("%d new unit(s)\n", (int)new_units);
+    printf("Total compile time of %d unit(s): %.3f s -> %.3f s (%+.1f%%)\n", (int)totals_after.units,
+        totals_before.compile_time, totals_after.compile_time,
+        calculate_relative_change(totals_before.compile_time, totals_after.compile_time));
+    printf("Total link time: %.3f s -> %.3f s, total output size: %d -> %d\n",
+        totals_before.link_time, totals_after.link_time, (int)totals_before.size, (int)totals_after.size);
+
+    bool result = true;
+    if (compile_time_limit > 0 && totals_after.compile_time > compile_time_limit)
+    {
+        fprintf(stderr, "The total compile time %.3f s exceeds the limit of %.3f s\n",
+            totals_after.compile_time, compile_time_limit);
+        result = false;
+    }
+
+    destroy_vector_and_content(changes, free);
+    destroy_tree_map(before);
+    destroy_tree_map(after);
+    destroy_vector_and_content(builds, (void*)destroy_build_record);
+    return result;
+}
@@ -0,0 +1,25 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the history of compile and link durations and output sizes
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef enum
+{
+    build_step_compile,
+    build_step_batched_compile,
+    build_step_link
+} build_step_kind_t;
+
+typedef struct build_history_t build_history_t;
+
+build_history_t * open_build_history(string_t *file_name);
+void record_build_step(build_history_t *history, build_step_kind_t kind, string_t *name, string_t *output_file,
+        double duration);
+void save_build_history(build_history_t *history);
+void destroy_build_history(build_history_t *history);
+bool print_build_history_report(string_t *file_name, double window_days, double compile_time_limit);
@@ -0,0 +1,526 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the object cache client and of the local cache server
+
+    An entry is addressed as <url>/<key>, where the key is 16 hex digits, and is read
+    by GET and written by PUT. The body of an entry is the outputs of one compile
+    action in the order they were declared, each one is a 64-bit big-endian size
+    followed by the contents. Every request uses its own connection, so the client
+    is shared by threads without locking.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+object_cache_t * connect_to_object_cache(const char *url)
+{
+    fprintf(stderr, "The object cache is not supported on this platform\n");
+    return NULL;
+}
+
+bool download_objects_from_cache(object_cache_t *cache, uint64_t key, vector_t *files)
+{
+    return false;
+}
+
+bool upload_objects_to_cache(object_cache_t *cache, uint64_t key, vector_t *files)
+{
+    return false;
+}
+
+void disconnect_object_cache(object_cache_t *cache)
+{
+}
+
+int run_cache_server(const char *port, const char *folder)
+{
+    fprintf(stderr, "The object cache server is not supported on this platform\n");
+    return -1;
+}
+
+#else
+
+#include "files.h"
+#include "folders.h"
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+static const int connect_timeout_ms = 2000;
+static const int io_timeout_s = 10;
+static const int max_failures = 3;
+static const size_t max_header_length = 8192;
+
+struct object_cache_t
+{
+    char *host;
+    char *port;
+    char *prefix;
+    pthread_mutex_t mutex;
+    int failures;
+};
+
+static void format_key(char *buff, uint64_t key)
+{
+    sprintf(buff, "%08x%08x", (unsigned int)(key >> 32), (unsigned int)key);
+}
+
+static bool is_content_length_header(const char *line)
+{
+    const char *name = "content-length:";
+    for (size_t i = 0; name[i]; i++)
+    {
+        if (tolower((unsigned char)line[i]) != name[i])
+            return false;
+    }
+    return true;
+}
+
+static int connect_with_timeout(const char *host, const char *port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *list;
+    if (getaddrinfo(host, port, &hints, &list) != 0)
+        return -1;
+    int fd = -1;
+    for (struct addrinfo *addr = list; addr && fd < 0; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        int result = connect(fd, addr->ai_addr, addr->ai_addrlen);
+        if (result != 0 && errno == EINPROGRESS)
+        {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (poll(&pfd, 1, connect_timeout_ms) == 1
+                    && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0)
+                result = 0;
+        }
+        if (result != 0)
+        {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        fcntl(fd, F_SETFL, flags);
+        struct timeval timeout = { io_timeout_s, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+
+/*
+    Reads the status line and the headers, returns the status code
+*/
+static int read_http_header(FILE *stream, long long *content_length)
+{
+    char line[1024];
+    int status = -1;
+    size_t total = 0;
+    *content_length = -1;
+    if (!fgets(line, sizeof(line), stream) || sscanf(line, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    while (fgets(line, sizeof(line), stream))
+    {
+        total += strlen(line);
+        if (total > max_header_length)
+            return -1;
+        if (line[0] == '\r' || line[0] == '\n')
+            return status;
+        if (is_content_length_header(line))
+            *content_length = atoll(line + 15);
+    }
+    return -1;
+}
+
+static bool copy_stream(FILE *input, FILE *output, unsigned long long size)
+{
+    char buff[65536];
+    while (size > 0)
+    {
+        size_t portion = size < sizeof(buff) ? (size_t)size : sizeof(buff);
+        if (fread(buff, 1, portion, input) != portion)
+            return false;
+        if (output && fwrite(buff, 1, portion, output) != portion)
+            return false;
+        size -= portion;
+    }
+    return true;
+}
+
+static bool write_u64(FILE *stream, unsigned long long value)
+{
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = (unsigned char)(value >> (56 - 8 * i));
+    return fwrite(bytes, 1, 8, stream) == 8;
+}
+
+static bool read_u64(FILE *stream, unsigned long long *value)
+{
+    unsigned char bytes[8];
+    if (fread(bytes, 1, 8, stream) != 8)
+        return false;
+    *value = 0;
+    for (int i = 0; i < 8; i++)
+        *value = (*value << 8) | bytes[i];
+    return true;
+}
+
+static bool open_http_streams(object_cache_t *cache, FILE **input, FILE **output)
+{
+    int fd = connect_with_timeout(cache->host, cache->port);
+    if (fd < 0)
+        return false;
+    int fd_copy = dup(fd);
+    *output = fdopen(fd, "w");
+    *input = fd_copy >= 0 ? fdopen(fd_copy, "r") : NULL;
+    if (*output && *input)
+        return true;
+    if (*output)
+        fclose(*output);
+    else
+        close(fd);
+    if (*input)
+        fclose(*input);
+    else if (fd_copy >= 0)
+        close(fd_copy);
+    return false;
+}
+
+static void register_result(object_cache_t *cache, bool connected)
+{
+    pthread_mutex_lock(&cache->mutex);
+    if (connected)
+        cache->failures = 0;
+    else if (++cache->failures == max_failures)
+        fprintf(stderr, "The object cache '%s:%s' is unavailable, continue without it\n", cache->host, cache->port);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+static bool is_cache_available(object_cache_t *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+    bool result = cache->failures < max_failures;
+    pthread_mutex_unlock(&cache->mutex);
+    return result;
+}
+
+object_cache_t * connect_to_object_cache(const char *url)
+{
+    const char *ptr = url;
+    if (strncmp(ptr, "http://", 7) == 0)
+        ptr += 7;
+    const char *host_end = ptr;
+    while (*host_end && *host_end != ':' && *host_end != '/')
+        host_end++;
+    if (host_end == ptr)
+    {
+        fprintf(stderr, "The object cache URL '%s' is incorrect\n", url);
+        return NULL;
+    }
+    const char *port_begin = *host_end == ':' ? host_end + 1 : host_end;
+    const char *port_end = port_begin;
+    while (*port_end && *port_end != '/')
+        port_end++;
+    const char *prefix = port_end;
+    size_t prefix_length = strlen(prefix);
+    while (prefix_length > 0 && prefix[prefix_length - 1] == '/')
+        prefix_length--;
+
+    object_cache_t *cache = nnalloc(sizeof(object_cache_t));
+    cache->host = strndup(ptr, host_end - ptr);
+    cache->port = port_end > port_begin ? strndup(port_begin, port_end - port_begin) : strdup("80");
+    cache->prefix = strndup(prefix, prefix_length);
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->failures = 0;
+    printf("> Using the object cache '%s:%s'\n", cache->host, cache->port);
+    return cache;
+}
+
+bool download_objects_from_cache(object_cache_t *cache, uint64_t key, vector_t *files)
+{
+    if (!is_cache_available(cache))
+        return false;
+    FILE *input, *output;
+    if (!open_http_streams(cache, &input, &output))
+    {
+        register_result(cache, false);
+        return false;
+    }
+    char key_str[17];
+    format_key(key_str, key);
+    fprintf(output, "GET %s/%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+        cache->prefix, key_str, cache->host);
+    bool sent = fflush(output) == 0;
+    long long content_length;
+    int status = sent ? read_http_header(input, &content_length) : -1;
+    register_result(cache, status > 0);
+
+    bool result = status == 200;
+    size_t received = 0;
+    for (size_t i = 0; i < files->size && result; i++)
+    {
+        string_t *file = (string_t*)files->data[i];
+        string_t *tmp_file = create_formatted_string("%S.tmp", *file);
+        unsigned long long size;
+        FILE *stream = NULL;
+        result = read_u64(input, &size) && (stream = fopen(tmp_file->data, "wb")) != NULL;
+        if (result)
+            result = copy_stream(input, stream, size);
+        if (stream && fclose(stream) != 0)
+            result = false;
+        if (result)
+            received++;
+        else
+            remove(tmp_file->data);
+        free(tmp_file);
+    }
+    // all outputs or nothing
+    for (size_t i = 0; i < received; i++)
+    {
+        string_t *file = (string_t*)files->data[i];
+        string_t *tmp_file = create_formatted_string("%S.tmp", *file);
+        if (!result || rename(tmp_file->data, file->data) != 0)
+        {
+            remove(tmp_file->data);
+            result = false;
+        }
+        free(tmp_file);
+    }
+    fclose(input);
+    fclose(output);
+    return result;
+}
+
+bool upload_objects_to_cache(object_cache_t *cache, uint64_t key, vector_t *files)
+{
+    if (!is_cache_available(cache))
+        return false;
+    unsigned long long content_length = 0;
+    for (size_t i = 0; i < files->size; i++)
+    {
+        struct stat info;
+        if (stat(((string_t*)files->data[i])->data, &info) != 0)
+            return false;
+        content_length += 8 + (unsigned long long)info.st_size;
+    }
+    FILE *input, *output;
+    if (!open_http_streams(cache, &input, &output))
+    {
+        register_result(cache, false);
+        return false;
+    }
+    char key_str[17];
+    format_key(key_str, key);
+    fprintf(output, "PUT %s/%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+        cache->prefix, key_str, cache->host, content_length);
+    bool result = true;
+    for (size_t i = 0; i < files->size && result; i++)
+    {
+        FILE *stream = fopen(((string_t*)files->data[i])->data, "rb");
+        struct stat info;
+        result = stream && fstat(fileno(stream), &info) == 0
+            && write_u64(output, (unsigned long long)info.st_size)
+            && copy_stream(stream, output, (unsigned long long)info.st_size);
+        if (stream)
+            fclose(stream);
+    }
+    long long response_length;
+    int status = result && fflush(output) == 0 ? read_http_header(input, &response_length) : -1;
+    register_result(cache, status > 0);
+    fclose(input);
+    fclose(output);
+    return status >= 200 && status < 300;
+}
+
+void disconnect_object_cache(object_cache_t *cache)
+{
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->host);
+    free(cache->port);
+    free(cache->prefix);
+    free(cache);
+}
+
+static bool is_cache_key(const char *str)
+{
+    size_t length = 0;
+    for (; str[length]; length++)
+    {
+        char c = str[length];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    }
+    return length == 16;
+}
+
+static void send_http_status(FILE *output, int status, const char *reason)
+{
+    fprintf(output, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, reason);
+}
+
+static void serve_cache_request(FILE *input, FILE *output, const char *folder)
+{
+    char line[1024];
+    char method[16];
+    char target[1024];
+    if (!fgets(line, sizeof(line), input) || sscanf(line, "%15s %1000s", method, target) != 2)
+    {
+        send_http_status(output, 400, "Bad Request");
+        return;
+    }
+    long long content_length = 0;
+    while (fgets(line, sizeof(line), input) && line[0] != '\r' && line[0] != '\n')
+    {
+        if (is_content_length_header(line))
+            content_length = atoll(line + 15);
+    }
+    const char *key = strrchr(target, '/');
+    key = key ? key + 1 : target;
+    if (!is_cache_key(key))
+    {
+        send_http_status(output, 404, "Not Found");
+        return;
+    }
+    string_t *path = create_formatted_string("%s/%s", folder, key);
+    if (strcmp(method, "GET") == 0)
+    {
+        FILE *stream = fopen(path->data, "rb");
+        struct stat info;
+        if (stream && fstat(fileno(stream), &info) == 0)
+        {
+            fprintf(output, "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+                (unsigned long long)info.st_size);
+            copy_stream(stream, output, (unsigned long long)info.st_size);
+        }
+        else
+        {
+            send_http_status(output, 404, "Not Found");
+        }
+        if (stream)
+            fclose(stream);
+        printf("GET %s %s\n", key, stream ? "hit" : "miss");
+    }
+    else if (strcmp(method, "PUT") == 0 && content_length >= 0)
+    {
+        // a partially received entry is never visible to readers
+        string_t *tmp_path = create_formatted_string("%s/%s.%d", folder, key, (int)getpid());
+        FILE *stream = fopen(tmp_path->data, "wb");
+        bool result = stream && copy_stream(input, stream, (unsigned long long)content_length);
+        if (stream && fclose(stream) != 0)
+            result = false;
+        if (result && rename(tmp_path->data, path->data) == 0)
+        {
+            send_http_status(output, 201, "Created");
+        }
+        else
+        {
+            remove(tmp_path->data);
+            send_http_status(output, 500, "Internal Server Error");
+        }
+        free(tmp_path);
+        printf("PUT %s %s\n", key, result ? "stored" : "failed");
+    }
+    else
+    {
+        send_http_status(output, 405, "Method Not Allowed");
+    }
+    fflush(stdout);
+    free(path);
+}
+
+int run_cache_server(const char *port, const char *folder)
+{
+    if (!folder_exists(folder) && !make_folder(folder))
+    {
+        fprintf(stderr, "Couldn't create folder '%s'\n", folder);
+        return -1;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *addr;
+    if (getaddrinfo(NULL, port, &hints, &addr) != 0)
+    {
+        fprintf(stderr, "The port '%s' is incorrect\n", port);
+        return -1;
+    }
+    int listener = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    int reuse = 1;
+    if (listener >= 0)
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listener < 0 || bind(listener, addr->ai_addr, addr->ai_addrlen) != 0 || listen(listener, 64) != 0)
+    {
+        fprintf(stderr, "Couldn't listen on port %s\n", port);
+        if (listener >= 0)
+            close(listener);
+        freeaddrinfo(addr);
+        return -1;
+    }
+    freeaddrinfo(addr);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+    printf("> Object cache is listening on port %s, entries are stored in '%s'...\n", port, folder);
+    fflush(stdout);
+    while (true)
+    {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listener);
+            FILE *input = fdopen(dup(connection), "r");
+            FILE *output = fdopen(connection, "w");
+            if (input && output)
+                serve_cache_request(input, output, folder);
+            if (input)
+                fclose(input);
+            if (output)
+                fclose(output);
+            _exit(0);
+        }
+        close(connection);
+    }
+    close(listener);
+    return -1;
+}
+
+#endif
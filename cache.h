@@ -0,0 +1,21 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the object cache client that talks HTTP to a shared cache,
+    and of the local cache server
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+#include <stdint.h>
+
+typedef struct object_cache_t object_cache_t;
+
+object_cache_t * connect_to_object_cache(const char *url);
+bool download_objects_from_cache(object_cache_t *cache, uint64_t key, vector_t *files);
+bool upload_objects_to_cache(object_cache_t *cache, uint64_t key, vector_t *files);
+void disconnect_object_cache(object_cache_t *cache);
+int run_cache_server(const char *port, const char *folder);
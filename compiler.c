@@ -2,11 +2,87 @@
     Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
 
     The structure that defines compiler
+
+    A backend is a family of compilers with its own command line builders: gcc, clang
+    and tcc. The backend is chosen per target in the root factory.json, for example
+    '"compilers": { "fastdebug": "tcc" }'; by default, 'fastdebug' is built by the fastest
+    compiler found and other targets are built by gcc. Capabilities of compilers are
+    probed once per run, and an unavailable backend falls back to gcc.
+
+    The 'native' target is tuned for the host CPU. The compiler resolves '-march=native'
+    to the name of the CPU, which is passed explicitly, so commands do not change meaning
+    on remote workers and in the object cache. The feature set is told by the macros the
+    compiler predefines for the CPU ('__AVX2__', '__FMA__' and so on); objects go to the
+    folder 'native-<cpu>-<hash of features>', so builds for different hosts never mix.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "compiler.h"
 #include "path.h"
 #include "stdlib_names.h"
+#include "process.h"
+#include "up_to_date.h"
+#include "hash.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+static const char *null_device =
+#ifdef _WIN32
+    "NUL";
+#else
+    "/dev/null";
+#endif
+
+/*
+    The shell expands the variable, so the command line, and the cache key made of it,
+    is the same in every checkout, while the compiler replaces the actual folder
+    in debug info and in __FILE__ with '.'
+*/
+static const char *current_folder_variable =
+#ifdef _WIN32
+    "%CD%";
+#else
+    "$PWD";
+#endif
+
+/*
+    A batch is compiled in the folder of its objects, so the command refers to the folder
+    where it has been started: the shell keeps it in OLDPWD after 'cd', while cmd.exe
+    expands variables before running any part of the command
+*/
+static const char *previous_folder_variable =
+#ifdef _WIN32
+    "%CD%";
+#else
+    "$OLDPWD";
+#endif
+
+static const char *change_folder_command =
+#ifdef _WIN32
+    "cd /d";
+#else
+    "cd";
+#endif
+
+/*
+    Linkers in the order of preference, the fastest first
+*/
+static const char *gcc_linkers[] =
+{
+    "mold",
+    "lld",
+    "gold",
+    NULL
+};
 
 static string_t * create_include_files_list_for_gcc(vector_t *list)
 {
@@ -20,21 +96,146 @@ static string_t * create_include_files_list_for_gcc(vector_t *list)
     return (string_t*)result;
 }
 
-static string_t * create_cmd_line_compile_for_gcc_debug(string_t *c_file, string_t *h_files, string_t *obj_file)
+static string_t * create_cmd_line_compile_for_gcc_ext(const compiler_t *compiler, const char *executable,
+    bool random_seed, string_t *c_file, string_t *h_files, string_t *obj_file, bool position_independent)
+{
+    string_builder_t *cmd = append_formatted_string(NULL, "%s %S -c %s -std=c99 -Werror -MMD",
+        executable, *c_file, compiler->flags);
+    if (compiler->prefix_map_option)
+        cmd = append_formatted_string(cmd, " \"%s=%s=.\"", compiler->prefix_map_option, current_folder_variable);
+    // the seed depends only on the relative object path, so objects do not differ from build to build
+    if (random_seed)
+        cmd = append_formatted_string(cmd, " -frandom-seed=%S", *obj_file);
+    if (compiler->split_debug_info)
+        cmd = append_formatted_string(cmd, " -gsplit-dwarf");
+    if (compiler->compressed_debug_info)
+        cmd = append_formatted_string(cmd, " -gz");
+    if (position_independent)
+        cmd = append_formatted_string(cmd, " -fPIC");
+    if (h_files)
+        cmd = append_formatted_string(cmd, " %S", *h_files);
+    cmd = append_formatted_string(cmd, " -o %S", *obj_file);
+    return (string_t*)cmd;
+}
+
+static string_t * create_cmd_line_compile_for_gcc(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+    string_t *obj_file, bool position_independent)
+{
+    return create_cmd_line_compile_for_gcc_ext(compiler, "gcc", true, c_file, h_files, obj_file, position_independent);
+}
+
+/*
+    clang does not use random numbers in names of symbols, so it does not need a seed
+*/
+static string_t * create_cmd_line_compile_for_clang(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+    string_t *obj_file, bool position_independent)
+{
+    return create_cmd_line_compile_for_gcc_ext(compiler, "clang", false, c_file, h_files, obj_file,
+        position_independent);
+}
+
+/*
+    tcc writes the dependency file only to the given name and has no options
+    for debug info or position independent code, its code is always relocatable
+*/
+static string_t * create_cmd_line_compile_for_tcc(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+    string_t *obj_file, bool position_independent)
 {
+    string_t *dep_file = create_dependency_file_name(obj_file);
+    string_builder_t *cmd = append_formatted_string(NULL, "tcc %S -c %s -std=c99 -Werror -MD -MF %S",
+        *c_file, compiler->flags, *dep_file);
+    free(dep_file);
     if (h_files)
-        return create_formatted_string("gcc %S -c -g -std=c99 -Werror %S -o %S", *c_file, *h_files, *obj_file);
-    return create_formatted_string("gcc %S -c -g -std=c99 -Werror -o %S", *c_file, *obj_file);
+        cmd = append_formatted_string(cmd, " %S", *h_files);
+    cmd = append_formatted_string(cmd, " -o %S", *obj_file);
+    return (string_t*)cmd;
 }
 
-static string_t * create_cmd_line_compile_for_gcc_release(string_t *c_file, string_t *h_files, string_t *obj_file)
+/*
+    The preprocessed text keeps line markers, which tell where every line comes from
+*/
+static string_t * create_cmd_line_preprocess_for_gcc_ext(const compiler_t *compiler, const char *executable,
+    string_t *c_file, string_t *h_files, string_t *output_file)
 {
+    string_builder_t *cmd = append_formatted_string(NULL, "%s %S -E %s -std=c99", executable, *c_file, compiler->flags);
     if (h_files)
-        return create_formatted_string("gcc %S -c -O3 -std=c99 -Werror %S -o %S", *c_file, *h_files, *obj_file);
-    return create_formatted_string("gcc %S -c -O3 -std=c99 -Werror -o %S", *c_file, *obj_file);
+        cmd = append_formatted_string(cmd, " %S", *h_files);
+    cmd = append_formatted_string(cmd, " -o %S", *output_file);
+    return (string_t*)cmd;
+}
+
+static string_t * create_cmd_line_preprocess_for_gcc(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+    string_t *output_file)
+{
+    return create_cmd_line_preprocess_for_gcc_ext(compiler, "gcc", c_file, h_files, output_file);
+}
+
+static string_t * create_cmd_line_preprocess_for_clang(const compiler_t *compiler, string_t *c_file,
+    string_t *h_files, string_t *output_file)
+{
+    return create_cmd_line_preprocess_for_gcc_ext(compiler, "clang", c_file, h_files, output_file);
+}
+
+static string_t * create_cmd_line_preprocess_for_tcc(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+    string_t *output_file)
+{
+    return create_cmd_line_preprocess_for_gcc_ext(compiler, "tcc", c_file, h_files, output_file);
+}
+
+static bool is_absolute_path(string_t *path)
+{
+    return (path->length > 0 && (path->data[0] == '/' || path->data[0] == '\\'))
+        || (path->length > 1 && path->data[1] == ':');
+}
+
+/*
+    Without '-o', the compiler writes every object and dependency file to the current folder,
+    named after the source; paths relative to the workspace are prefixed by the root path
+*/
+static string_t * create_cmd_line_compile_batch_for_gcc_ext(const compiler_t *compiler, const char *executable,
+    bool random_seed, vector_t *c_file_list, vector_t *header_list, string_t *obj_folder, string_t *root_path,
+    bool position_independent)
+{
+    string_builder_t *cmd = append_formatted_string(NULL, "%s %S && %s -c %s -std=c99 -Werror -MMD",
+        change_folder_command, *obj_folder, executable, compiler->flags);
+    if (compiler->prefix_map_option)
+        cmd = append_formatted_string(cmd, " \"%s=%s=.\"", compiler->prefix_map_option, previous_folder_variable);
+    if (random_seed)
+        cmd = append_formatted_string(cmd, " -frandom-seed=%S", *obj_folder);
+    if (compiler->split_debug_info)
+        cmd = append_formatted_string(cmd, " -gsplit-dwarf");
+    if (compiler->compressed_debug_info)
+        cmd = append_formatted_string(cmd, " -gz");
+    if (position_independent)
+        cmd = append_formatted_string(cmd, " -fPIC");
+    for (size_t i = 0; i < header_list->size; i++)
+    {
+        string_t *folder = (string_t*)header_list->data[i];
+        cmd = append_formatted_string(cmd, " -I%S%S", is_absolute_path(folder) ? __S("") : *root_path, *folder);
+    }
+    for (size_t i = 0; i < c_file_list->size; i++)
+    {
+        string_t *c_file = (string_t*)c_file_list->data[i];
+        cmd = append_formatted_string(cmd, " %S%S", is_absolute_path(c_file) ? __S("") : *root_path, *c_file);
+    }
+    return (string_t*)cmd;
 }
 
-char *gcc_stdlib_names[] = 
+static string_t * create_cmd_line_compile_batch_for_gcc(const compiler_t *compiler, vector_t *c_file_list,
+    vector_t *header_list, string_t *obj_folder, string_t *root_path, bool position_independent)
+{
+    return create_cmd_line_compile_batch_for_gcc_ext(compiler, "gcc", true, c_file_list, header_list,
+        obj_folder, root_path, position_independent);
+}
+
+static string_t * create_cmd_line_compile_batch_for_clang(const compiler_t *compiler, vector_t *c_file_list,
+    vector_t *header_list, string_t *obj_folder, string_t *root_path, bool position_independent)
+{
+    return create_cmd_line_compile_batch_for_gcc_ext(compiler, "clang", false, c_file_list, header_list,
+        obj_folder, root_path, position_independent);
+}
+
+char *gcc_stdlib_names[] =
 {
     "pthread",
     "m",
@@ -45,60 +246,724 @@ char *gcc_stdlib_names[] =
 #endif
 };
 
-static string_t * create_cmd_line_link_for_gcc(string_t *target_folder, vector_t *object_file_list,
-     long int stdlib_mask, string_t *exe_file)
+/*
+    Objects are passed to the linker in a response file, so the command line stays short
+    however many objects there are. The content is measured first and built in one buffer;
+    every path is quoted, with quotes and backslashes escaped, as gcc, clang and tcc expect.
+    The command line only names the file, which is written when the link is going to run
+*/
+static size_t get_escaped_path_length(string_t *target_folder, string_t *object_file)
 {
-    string_builder_t *obj_files = NULL;
+    size_t length = target_folder->length + 1 + object_file->length + 3;
+    length += (path_separator == '\\');
+    for (size_t i = 0; i < target_folder->length; i++)
+        length += (target_folder->data[i] == '"' || target_folder->data[i] == '\\');
+    for (size_t i = 0; i < object_file->length; i++)
+        length += (object_file->data[i] == '"' || object_file->data[i] == '\\');
+    return length;
+}
+
+static char * append_escaped_char(char *buffer, char c)
+{
+    if (c == '"' || c == '\\')
+        *buffer++ = '\\';
+    *buffer++ = c;
+    return buffer;
+}
+
+static char * append_escaped_chars(char *buffer, string_t *str)
+{
+    for (size_t i = 0; i < str->length; i++)
+        buffer = append_escaped_char(buffer, str->data[i]);
+    return buffer;
+}
+
+static string_t * create_response_file_name(string_t *target_folder, string_t *output_file)
+{
+    return create_formatted_string("%S%c%S.rsp", *target_folder, path_separator, *output_file);
+}
+
+/*
+    If the file can't be written, an old one is removed, so the link fails rather than
+    takes a stale list of objects
+*/
+bool write_response_file(string_t *target_folder, vector_t *object_file_list, string_t *output_file)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < object_file_list->size; i++)
+        size += get_escaped_path_length(target_folder, (string_t*)object_file_list->data[i]);
+    char *buffer = nnalloc(size ? size : 1);
+    char *end = buffer;
     for (size_t i = 0; i < object_file_list->size; i++)
     {
-        if (i)
-            obj_files = append_char(obj_files, ' ');
-        obj_files = append_formatted_string(obj_files, "%S%c%S", 
-            *target_folder, path_separator, *((string_t*)object_file_list->data[i]));
+        *end++ = '"';
+        end = append_escaped_chars(end, target_folder);
+        end = append_escaped_char(end, path_separator);
+        end = append_escaped_chars(end, (string_t*)object_file_list->data[i]);
+        *end++ = '"';
+        *end++ = '\n';
+    }
+    string_t *file_name = create_response_file_name(target_folder, output_file);
+    FILE *stream = fopen(file_name->data, "wb");
+    bool result = stream && fwrite(buffer, 1, size, stream) == size;
+    if (stream)
+        result = fclose(stream) == 0 && result;
+    free(buffer);
+    if (!result)
+    {
+        fprintf(stderr, "Couldn't write the response file '%s'\n", file_name->data);
+        remove(file_name->data);
+    }
+    free(file_name);
+    return result;
+}
+
+static string_builder_t * append_response_file(string_builder_t *cmd, string_t *target_folder, string_t *output_file)
+{
+    string_t *response_file = create_response_file_name(target_folder, output_file);
+    cmd = append_formatted_string(cmd, " @%S", *response_file);
+    free(response_file);
+    return cmd;
+}
+
+static string_t * create_cmd_line_link_for_gcc_ext(const compiler_t *compiler, const char *executable,
+    const char *flags, string_t *target_folder, vector_t *object_file_list, vector_t *library_list,
+    long int stdlib_mask, string_t *output_file)
+{
+    string_builder_t *cmd = append_formatted_string(NULL, "%s%s", executable, flags);
+    if (compiler->linker)
+    {
+        cmd = append_formatted_string(cmd, " -fuse-ld=%s", compiler->linker);
+        if (compiler->split_debug_info)
+            cmd = append_formatted_string(cmd, " -Wl,--gdb-index");
     }
-    string_t *cmd;
-    if (stdlib_mask == 0)
+    if (compiler->compressed_debug_info)
+        cmd = append_formatted_string(cmd, " -gz");
+    cmd = append_response_file(cmd, target_folder, output_file);
+    if (library_list && library_list->size)
     {
-        cmd = create_formatted_string("gcc %S -o %S%c%S",
-            *((string_t*)obj_files), *target_folder, path_separator, *exe_file);
+        cmd = append_formatted_string(cmd, " -L%S", *target_folder);
+        for (size_t i = 0; i < library_list->size; i++)
+            cmd = append_formatted_string(cmd, " -l%S", *((string_t*)library_list->data[i]));
+#ifndef _WIN32
+        cmd = append_formatted_string(cmd, " -Wl,-rpath,'$ORIGIN'");
+#endif
     }
-    else
+    for (size_t j = 0; j < l_unknown; j++)
     {
-        string_builder_t *libraries = create_string_builder(0);
-        for (size_t j = 0; j < l_unknown; j++)
+        if (stdlib_mask & (1 << j))
         {
-            if (stdlib_mask & (1 << j))
-            {
-                char *lib = gcc_stdlib_names[j];
-                if (lib)
-                    libraries = append_formatted_string(libraries, " -l%s", lib);
-            }
+            char *lib = gcc_stdlib_names[j];
+            if (lib)
+                cmd = append_formatted_string(cmd, " -l%s", lib);
         }
-        cmd = create_formatted_string("gcc %S%S -o %S%c%S",
-            *((string_t*)obj_files), *((string_t*)libraries), *target_folder, path_separator, *exe_file);
-        free(libraries);
     }
-    free(obj_files);
-    return cmd;
+    cmd = append_formatted_string(cmd, " -o %S%c%S", *target_folder, path_separator, *output_file);
+    return (string_t*)cmd;
+}
+
+static string_t * create_cmd_line_link_for_gcc(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *exe_file)
+{
+    return create_cmd_line_link_for_gcc_ext(compiler, "gcc", "", target_folder, object_file_list,
+        library_list, stdlib_mask, exe_file);
+}
+
+static string_t * create_cmd_line_link_shared_library_for_gcc(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *lib_file)
+{
+    return create_cmd_line_link_for_gcc_ext(compiler, "gcc", " -shared", target_folder, object_file_list,
+        library_list, stdlib_mask, lib_file);
+}
+
+static string_t * create_cmd_line_link_for_clang(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *exe_file)
+{
+    return create_cmd_line_link_for_gcc_ext(compiler, "clang", "", target_folder, object_file_list,
+        library_list, stdlib_mask, exe_file);
+}
+
+static string_t * create_cmd_line_link_shared_library_for_clang(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *lib_file)
+{
+    return create_cmd_line_link_for_gcc_ext(compiler, "clang", " -shared", target_folder, object_file_list,
+        library_list, stdlib_mask, lib_file);
+}
+
+/*
+    tcc has its own linker, so the linker option and the debug info options are ignored
+*/
+static string_t * create_cmd_line_link_for_tcc_ext(const char *flags, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *output_file)
+{
+    string_builder_t *cmd = append_formatted_string(NULL, "tcc%s", flags);
+    cmd = append_response_file(cmd, target_folder, output_file);
+    if (library_list && library_list->size)
+    {
+        cmd = append_formatted_string(cmd, " -L%S", *target_folder);
+        for (size_t i = 0; i < library_list->size; i++)
+            cmd = append_formatted_string(cmd, " -l%S", *((string_t*)library_list->data[i]));
+#ifndef _WIN32
+        cmd = append_formatted_string(cmd, " -Wl,-rpath='$ORIGIN'");
+#endif
+    }
+    for (size_t j = 0; j < l_unknown; j++)
+    {
+        if (stdlib_mask & (1 << j))
+        {
+            char *lib = gcc_stdlib_names[j];
+            if (lib)
+                cmd = append_formatted_string(cmd, " -l%s", lib);
+        }
+    }
+    cmd = append_formatted_string(cmd, " -o %S%c%S", *target_folder, path_separator, *output_file);
+    return (string_t*)cmd;
+}
+
+static string_t * create_cmd_line_link_for_tcc(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *exe_file)
+{
+    return create_cmd_line_link_for_tcc_ext("", target_folder, object_file_list, library_list, stdlib_mask, exe_file);
+}
+
+static string_t * create_cmd_line_link_shared_library_for_tcc(const compiler_t *compiler, string_t *target_folder,
+     vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *lib_file)
+{
+    return create_cmd_line_link_for_tcc_ext(" -shared", target_folder, object_file_list, library_list, stdlib_mask,
+        lib_file);
+}
+
+static bool is_linker_available(const char *executable, const char *linker)
+{
+    string_t *cmd = create_formatted_string("%s -fuse-ld=%s -Wl,--version", executable, linker);
+    bool result = execute_command(cmd->data, NULL, null_device) == 0;
+    free(cmd);
+    return result;
+}
+
+static const char * find_fastest_linker(const char *executable)
+{
+    const char *fastest_linker = NULL;
+    for (size_t i = 0; gcc_linkers[i] && !fastest_linker; i++)
+    {
+        if (is_linker_available(executable, gcc_linkers[i]))
+            fastest_linker = gcc_linkers[i];
+    }
+    if (fastest_linker)
+        printf("> Using the '%s' linker with %s\n", fastest_linker, executable);
+    return fastest_linker;
+}
+
+static bool is_option_supported(const char *executable, const char *option)
+{
+    string_t *cmd = create_formatted_string("%s %s -E -x c %s", executable, option, null_device);
+    bool result = execute_command(cmd->data, NULL, null_device) == 0;
+    free(cmd);
+    return result;
+}
+
+/*
+    '-ffile-prefix-map' appeared in gcc 8 and clang 10, older versions only rewrite debug info
+*/
+static const char * find_prefix_map_option(const char *executable)
+{
+    if (is_option_supported(executable, "-ffile-prefix-map=a=b"))
+        return "-ffile-prefix-map";
+    if (is_option_supported(executable, "-fdebug-prefix-map=a=b"))
+        return "-fdebug-prefix-map";
+    return NULL;
+}
+
+static bool read_command_output(const char *cmd, char *buffer, size_t size)
+{
+    FILE *stream = popen(cmd, "r");
+    if (!stream)
+        return false;
+    size_t length = fread(buffer, 1, size - 1, stream);
+    buffer[length] = '\0';
+    return pclose(stream) == 0 && length > 0;
+}
+
+/*
+    Capabilities of a backend that are probed once per run
+*/
+typedef struct
+{
+    bool detected;
+    bool available;
+    const char *prefix_map_option;
+    const char *fastest_linker;
+} capabilities_t;
+
+static const capabilities_t * get_gcc_capabilities()
+{
+    static capabilities_t caps = { false };
+    if (!caps.detected)
+    {
+        caps.available = true;
+        caps.prefix_map_option = find_prefix_map_option("gcc");
+        caps.fastest_linker = find_fastest_linker("gcc");
+        caps.detected = true;
+    }
+    return &caps;
+}
+
+static const capabilities_t * get_clang_capabilities()
+{
+    static capabilities_t caps = { false };
+    if (!caps.detected)
+    {
+        caps.available = execute_command("clang --version", NULL, null_device) == 0;
+        if (caps.available)
+        {
+            caps.prefix_map_option = find_prefix_map_option("clang");
+            caps.fastest_linker = find_fastest_linker("clang");
+        }
+        caps.detected = true;
+    }
+    return &caps;
+}
+
+/*
+    Dependency files ('-MD -MF') and '-std=c99' appeared in tcc 0.9.27
+*/
+static const capabilities_t * get_tcc_capabilities()
+{
+    static capabilities_t caps = { false };
+    if (!caps.detected)
+    {
+        char output[256];
+        int major = 0, minor = 0, patch = 0;
+        if (read_command_output("tcc -v", output, sizeof(output))
+                && sscanf(output, "tcc version %d.%d.%d", &major, &minor, &patch) >= 2)
+        {
+            caps.available = major > 0 || minor > 9 || (minor == 9 && patch >= 27);
+        }
+        caps.detected = true;
+    }
+    return &caps;
+}
+
+/*
+    The version is told by '-v', with the options the compiler was configured with;
+    folders of the standard headers are listed after a line that starts the list,
+    one per line, indented
+*/
+static void probe_compiler_identity(compiler_identity_t *identity, const char *version_cmd,
+    const char *search_cmd, const char *list_start)
+{
+    char output[8192];
+    identity->version_hash = initial_hash_value;
+    if (read_command_output(version_cmd, output, sizeof(output)))
+        identity->version_hash = calculate_hash(initial_hash_value, output, strlen(output));
+    identity->system_header_list = create_vector();
+    if (!read_command_output(search_cmd, output, sizeof(output)))
+        return;
+    char *line = strstr(output, list_start);
+    line = line ? strchr(line, '\n') : NULL;
+    while (line && line[1] == ' ')
+    {
+        line += 2;
+        char *end = strchr(line, '\n');
+        size_t length = end ? (size_t)(end - line) : strlen(line);
+        while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
+            length--;
+        while (length > 0 && *line == ' ')
+        {
+            line++;
+            length--;
+        }
+        // clang also lists folders of macOS frameworks, which are not searched for '#include <...>'
+        static const char framework_suffix[] = " (framework directory)";
+        size_t suffix_length = sizeof(framework_suffix) - 1;
+        bool framework = length >= suffix_length
+            && 0 == memcmp(line + length - suffix_length, framework_suffix, suffix_length);
+        if (length > 0 && !framework)
+            add_item_to_vector(identity->system_header_list, duplicate_string((string_t){ line, length }));
+        line = end;
+    }
+}
+
+static const compiler_identity_t * get_gcc_identity()
+{
+    static compiler_identity_t identity;
+    static bool detected = false;
+    if (!detected)
+    {
+        string_t *search_cmd = create_formatted_string("gcc -E -v -x c %s 2>&1", null_device);
+        probe_compiler_identity(&identity, "gcc -v 2>&1", search_cmd->data, "#include <...> search starts here:");
+        free(search_cmd);
+        detected = true;
+    }
+    return &identity;
+}
+
+static const compiler_identity_t * get_clang_identity()
+{
+    static compiler_identity_t identity;
+    static bool detected = false;
+    if (!detected)
+    {
+        string_t *search_cmd = create_formatted_string("clang -E -v -x c %s 2>&1", null_device);
+        probe_compiler_identity(&identity, "clang -v 2>&1", search_cmd->data, "#include <...> search starts here:");
+        free(search_cmd);
+        detected = true;
+    }
+    return &identity;
+}
+
+static const compiler_identity_t * get_tcc_identity()
+{
+    static compiler_identity_t identity;
+    static bool detected = false;
+    if (!detected)
+    {
+        probe_compiler_identity(&identity, "tcc -v", "tcc -vv", "include:");
+        detected = true;
+    }
+    return &identity;
+}
+
+/*
+    The host CPU as seen by a backend, probed once per run
+*/
+typedef struct
+{
+    bool detected;
+    bool available;
+    char cpu[64];
+    char folder_suffix[64 + 32];
+    char flags[2 * 64 + 32];
+} native_target_t;
+
+static bool is_feature_macro(const char *line, size_t *length)
+{
+    if (strncmp(line, "#define __", 10) != 0)
+        return false;
+    const char *name = line + 8;
+    size_t index = 0;
+    while (name[index] && name[index] != ' ')
+        index++;
+    if (index < 5 || name[index - 1] != '_' || name[index - 2] != '_' || strcmp(name + index, " 1\n") != 0)
+        return false;
+    *length = index;
+    return true;
+}
+
+/*
+    The macros are listed in no particular order, so their hashes are summed up
+*/
+static bool calculate_cpu_features_hash(const char *executable, uint64_t *hash)
+{
+    string_t *cmd = create_formatted_string("%s -march=native -dM -E -x c %s", executable, null_device);
+    FILE *stream = popen(cmd->data, "r");
+    free(cmd);
+    if (!stream)
+        return false;
+    char line[256];
+    size_t count = 0;
+    *hash = 0;
+    while (fgets(line, sizeof(line), stream))
+    {
+        size_t length;
+        if (is_feature_macro(line, &length))
+        {
+            *hash += calculate_hash(initial_hash_value, line + 8, length);
+            count++;
+        }
+    }
+    return pclose(stream) == 0 && count > 0;
+}
+
+/*
+    gcc prints the resolved value of '-march' among the target options,
+    clang passes it to the compiler proper as '-target-cpu'
+*/
+static bool find_native_cpu(const char *executable, char *cpu, size_t size)
+{
+    bool is_gcc = 0 == strcmp(executable, "gcc");
+    string_t *cmd = is_gcc ?
+        create_formatted_string("%s -march=native -Q --help=target", executable) :
+        create_formatted_string("%s -march=native -### -c -x c %s 2>&1", executable, null_device);
+    FILE *stream = popen(cmd->data, "r");
+    free(cmd);
+    if (!stream)
+        return false;
+    char line[1024];
+    char format[32];
+    snprintf(format, sizeof(format), is_gcc ? " -march= %%%ds" : "\"-target-cpu\" \"%%%d[^\"]", (int)(size - 1));
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), stream))
+    {
+        const char *option = strstr(line, is_gcc ? "-march=" : "\"-target-cpu\"");
+        found = option && (!is_gcc || option == line + strspn(line, " \t"))
+            && sscanf(is_gcc ? line : option, format, cpu) == 1;
+    }
+    pclose(stream);
+    // a name that fills the buffer may have been cut
+    return found && strlen(cpu) + 1 < size && 0 != strcmp(cpu, "native");
+}
+
+/*
+    clang warns that '-mtune' is unused with some versions, and warnings are errors,
+    so only gcc gets it; '-march' implies tuning for the same CPU anyway
+*/
+static void probe_native_target(const char *executable, native_target_t *native)
+{
+    uint64_t hash;
+    native->available = find_native_cpu(executable, native->cpu, sizeof(native->cpu))
+        && calculate_cpu_features_hash(executable, &hash);
+    if (native->available)
+    {
+        // a truncated option would name another CPU, or none
+        int suffix_length = snprintf(native->folder_suffix, sizeof(native->folder_suffix), "%s-%08llx",
+            native->cpu, (unsigned long long)(hash & 0xFFFFFFFF));
+        int flags_length;
+        if (0 == strcmp(executable, "gcc"))
+            flags_length = snprintf(native->flags, sizeof(native->flags), "-O3 -march=%s -mtune=%s",
+                native->cpu, native->cpu);
+        else
+            flags_length = snprintf(native->flags, sizeof(native->flags), "-O3 -march=%s", native->cpu);
+        native->available = suffix_length > 0 && (size_t)suffix_length < sizeof(native->folder_suffix)
+            && flags_length > 0 && (size_t)flags_length < sizeof(native->flags);
+    }
+    if (!native->available)
+    {
+        printf("> The host CPU couldn't be probed by %s, the 'native' target is built for a generic CPU\n",
+            executable);
+    }
+    native->detected = true;
 }
 
-static const compiler_t gcc_debug =
+static const native_target_t * get_gcc_native_target()
 {
-    create_include_files_list_for_gcc,
-    create_cmd_line_compile_for_gcc_debug,
-    create_cmd_line_link_for_gcc
+    static native_target_t native = { false };
+    if (!native.detected)
+        probe_native_target("gcc", &native);
+    return &native;
+}
+
+static const native_target_t * get_clang_native_target()
+{
+    static native_target_t native = { false };
+    if (!native.detected)
+        probe_native_target("clang", &native);
+    return &native;
+}
+
+/*
+    'bfd' is the default linker of the toolchain, it is used without the '-fuse-ld' option
+*/
+static const char * get_linker(const capabilities_t *caps, string_t *name)
+{
+    if (!name || are_strings_equal(*name, __S("auto")))
+        return caps->fastest_linker;
+    for (size_t i = 0; gcc_linkers[i]; i++)
+    {
+        if (are_strings_equal(*name, _S(gcc_linkers[i])))
+            return gcc_linkers[i];
+    }
+    return NULL;
+}
+
+bool is_known_linker(string_t name)
+{
+    if (are_strings_equal(name, __S("auto")) || are_strings_equal(name, __S("bfd")))
+        return true;
+    for (size_t i = 0; gcc_linkers[i]; i++)
+    {
+        if (are_strings_equal(name, _S(gcc_linkers[i])))
+            return true;
+    }
+    return false;
+}
+
+/*
+    'fastdebug' trades the quality of code and debug info for the speed of compilation:
+    no optimization and only line tables
+*/
+static const char * get_target_flags(string_t target, const char *debug, const char *fastdebug,
+    const char *release)
+{
+    if (are_strings_equal(target, __S("debug")))
+        return debug;
+    if (are_strings_equal(target, __S("fastdebug")))
+        return fastdebug;
+    return release;
+}
+
+static void set_native_target_options(compiler_t *compiler, string_t target, const native_target_t * (*probe)())
+{
+    if (are_strings_equal(target, __S("native")))
+    {
+        const native_target_t *native = probe();
+        if (native->available)
+            compiler->flags = native->flags;
+    }
+}
+
+/*
+    Only gcc and clang can split or compress debug info
+*/
+static void set_debug_info_options(compiler_t *compiler, string_t target, const compiler_options_t *options)
+{
+    if (are_strings_equal(target, __S("debug")))
+    {
+        compiler->split_debug_info = options->split_debug_info;
+        compiler->compressed_debug_info = options->compressed_debug_info;
+    }
+}
+
+static bool init_gcc_compiler(compiler_t *compiler, string_t target, const compiler_options_t *options)
+{
+    const capabilities_t *caps = get_gcc_capabilities();
+    compiler->create_include_files_list = create_include_files_list_for_gcc;
+    compiler->create_cmd_line_compile = create_cmd_line_compile_for_gcc;
+    compiler->create_cmd_line_preprocess = create_cmd_line_preprocess_for_gcc;
+    compiler->create_cmd_line_compile_batch = create_cmd_line_compile_batch_for_gcc;
+    compiler->create_cmd_line_link = create_cmd_line_link_for_gcc;
+    compiler->create_cmd_line_link_shared_library = create_cmd_line_link_shared_library_for_gcc;
+    compiler->get_identity = get_gcc_identity;
+    compiler->flags = get_target_flags(target, "-g", "-O0 -g1", "-O3");
+    set_native_target_options(compiler, target, get_gcc_native_target);
+    compiler->prefix_map_option = caps->prefix_map_option;
+    compiler->linker = get_linker(caps, options->linker);
+    compiler->batch_size = options->batch_size;
+    set_debug_info_options(compiler, target, options);
+    return true;
+}
+
+static bool init_clang_compiler(compiler_t *compiler, string_t target, const compiler_options_t *options)
+{
+    const capabilities_t *caps = get_clang_capabilities();
+    if (!caps->available)
+        return false;
+    compiler->create_include_files_list = create_include_files_list_for_gcc;
+    compiler->create_cmd_line_compile = create_cmd_line_compile_for_clang;
+    compiler->create_cmd_line_preprocess = create_cmd_line_preprocess_for_clang;
+    compiler->create_cmd_line_compile_batch = create_cmd_line_compile_batch_for_clang;
+    compiler->create_cmd_line_link = create_cmd_line_link_for_clang;
+    compiler->create_cmd_line_link_shared_library = create_cmd_line_link_shared_library_for_clang;
+    compiler->get_identity = get_clang_identity;
+    compiler->flags = get_target_flags(target, "-g", "-O0 -gline-tables-only", "-O3");
+    set_native_target_options(compiler, target, get_clang_native_target);
+    compiler->prefix_map_option = caps->prefix_map_option;
+    compiler->linker = get_linker(caps, options->linker);
+    compiler->batch_size = options->batch_size;
+    set_debug_info_options(compiler, target, options);
+    return true;
+}
+
+/*
+    tcc starts much faster than the gcc driver, batches would gain little;
+    it can't generate code for a particular CPU, so it does not build the 'native' target
+*/
+static bool init_tcc_compiler(compiler_t *compiler, string_t target, const compiler_options_t *options)
+{
+    const capabilities_t *caps = get_tcc_capabilities();
+    if (!caps->available || are_strings_equal(target, __S("native")))
+        return false;
+    compiler->create_include_files_list = create_include_files_list_for_gcc;
+    compiler->create_cmd_line_compile = create_cmd_line_compile_for_tcc;
+    compiler->create_cmd_line_preprocess = create_cmd_line_preprocess_for_tcc;
+    compiler->create_cmd_line_link = create_cmd_line_link_for_tcc;
+    compiler->create_cmd_line_link_shared_library = create_cmd_line_link_shared_library_for_tcc;
+    compiler->get_identity = get_tcc_identity;
+    compiler->flags = get_target_flags(target, "-g", "-g", "-O2");
+    return true;
+}
+
+typedef struct
+{
+    const char *name;
+    bool (*init)(compiler_t *compiler, string_t target, const compiler_options_t *options);
+} backend_t;
+
+static const backend_t backends[] =
+{
+    { "gcc", init_gcc_compiler },
+    { "clang", init_clang_compiler },
+    { "tcc", init_tcc_compiler },
+    { NULL, NULL }
 };
 
-static const compiler_t gcc_release = 
+/*
+    Backends tried for 'fastdebug' when factory.json does not name one, the fastest first
+*/
+static const char *fastdebug_backends[] =
 {
-    create_include_files_list_for_gcc,
-    create_cmd_line_compile_for_gcc_release,
-    create_cmd_line_link_for_gcc
+    "tcc",
+    "clang",
+    "gcc",
+    NULL
 };
 
-const compiler_t * get_appropriate_compiler(string_t target)
+static const backend_t * find_backend(string_t name)
 {
-    if (are_strings_equal(target, __S("debug")))
-        return &gcc_debug;
-    return &gcc_release;
+    for (size_t i = 0; backends[i].name; i++)
+    {
+        if (are_strings_equal(name, _S(backends[i].name)))
+            return &backends[i];
+    }
+    return NULL;
+}
+
+bool is_known_compiler_backend(string_t name)
+{
+    return find_backend(name) != NULL;
+}
+
+static const string_t * get_configured_backend(string_t target, const compiler_options_t *options)
+{
+    for (size_t i = 0; i < options->backends.count; i++)
+    {
+        if (are_strings_equal(target, *options->backends.targets[i]))
+            return options->backends.names[i];
+    }
+    return NULL;
+}
+
+compiler_t * get_appropriate_compiler(string_t target, const compiler_options_t *options)
+{
+    compiler_t *compiler = nnalloc(sizeof(compiler_t));
+    memset(compiler, 0, sizeof(compiler_t));
+    const string_t *name = get_configured_backend(target, options);
+    bool initialized = false;
+    if (name)
+    {
+        initialized = find_backend(*name)->init(compiler, target, options);
+        if (!initialized)
+        {
+            printf("> The '%.*s' compiler is not available, the '%.*s' target is built by gcc\n",
+                (int)name->length, name->data, (int)target.length, target.data);
+        }
+    }
+    else if (are_strings_equal(target, __S("fastdebug")))
+    {
+        for (size_t i = 0; fastdebug_backends[i] && !initialized; i++)
+            initialized = find_backend(_S(fastdebug_backends[i]))->init(compiler, target, options);
+    }
+    if (!initialized)
+        init_gcc_compiler(compiler, target, options);
+    return compiler;
+}
+
+/*
+    The same choice of backend as above, without probing anything but the CPU
+*/
+string_t * create_target_folder_name(string_t target, const compiler_options_t *options)
+{
+    if (!are_strings_equal(target, __S("native")))
+        return duplicate_string(target);
+    const string_t *name = get_configured_backend(target, options);
+    const native_target_t *native = name && are_strings_equal(*name, __S("clang")) && get_clang_capabilities()->available ?
+        get_clang_native_target() : get_gcc_native_target();
+    if (!native->available)
+        return duplicate_string(target);
+    return create_formatted_string("%S-%s", target, native->folder_suffix);
+}
+
+void destroy_compiler(compiler_t *compiler)
+{
+    free(compiler);
 }
@@ -9,12 +9,58 @@
 #include "strings.h"
 #include "vector.h"
 
+#include <stdint.h>
+
 typedef struct
+{
+    struct
+    {
+        string_t **targets;
+        string_t **names;
+        size_t count;
+    } backends;
+    string_t *linker;
+    size_t batch_size;
+    bool split_debug_info;
+    bool compressed_debug_info;
+} compiler_options_t;
+
+/*
+    What the object cache needs to know about a compiler besides its command lines
+*/
+typedef struct
+{
+    uint64_t version_hash;
+    vector_t *system_header_list;
+} compiler_identity_t;
+
+typedef struct compiler_t compiler_t;
+
+struct compiler_t
 {
     string_t * (*create_include_files_list)(vector_t *list);
-    string_t * (*create_cmd_line_compile)(string_t *c_file, string_t *h_files, string_t *obj_file);
-    string_t * (*create_cmd_line_link)(string_t *target_folder, vector_t *object_file_list,
-                    long int stdlib_mask, string_t *exe_file);
-} compiler_t;
+    string_t * (*create_cmd_line_compile)(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+                    string_t *obj_file, bool position_independent);
+    string_t * (*create_cmd_line_compile_batch)(const compiler_t *compiler, vector_t *c_file_list,
+                    vector_t *header_list, string_t *obj_folder, string_t *root_path, bool position_independent);
+    string_t * (*create_cmd_line_preprocess)(const compiler_t *compiler, string_t *c_file, string_t *h_files,
+                    string_t *output_file);
+    string_t * (*create_cmd_line_link)(const compiler_t *compiler, string_t *target_folder, vector_t *object_file_list,
+                    vector_t *library_list, long int stdlib_mask, string_t *exe_file);
+    string_t * (*create_cmd_line_link_shared_library)(const compiler_t *compiler, string_t *target_folder,
+                    vector_t *object_file_list, vector_t *library_list, long int stdlib_mask, string_t *lib_file);
+    const compiler_identity_t * (*get_identity)();
+    const char *flags;
+    const char *prefix_map_option;
+    const char *linker;
+    size_t batch_size;
+    bool split_debug_info;
+    bool compressed_debug_info;
+};
 
-const compiler_t * get_appropriate_compiler(string_t target);
+bool is_known_compiler_backend(string_t name);
+bool is_known_linker(string_t name);
+bool write_response_file(string_t *target_folder, vector_t *object_file_list, string_t *output_file);
+compiler_t * get_appropriate_compiler(string_t target, const compiler_options_t *options);
+string_t * create_target_folder_name(string_t target, const compiler_options_t *options);
+void destroy_compiler(compiler_t *compiler);
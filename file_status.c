@@ -0,0 +1,288 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the function that queries modification times of many files at once
+
+    On Linux, the requests are submitted as a batch of 'statx' operations to an io_uring,
+    so the kernel works on them concurrently and the number of system calls does not
+    grow with the number of files. Where io_uring is missing, forbidden, or does not
+    support 'statx' (kernels before 5.6), the files are checked by a pool of threads,
+    which hides the latency of slow filesystems in the same way.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include "file_status.h"
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+    Fewer files are checked faster one by one than by starting anything
+*/
+#define MIN_BATCH_SIZE 16
+#define MAX_THREADS_COUNT 16
+#define THREAD_CHUNK_SIZE 32
+
+static void get_file_statuses_sequentially(file_status_t *list, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        list[i].exists = get_file_modification_time(list[i].path, &list[i].time);
+}
+
+typedef struct
+{
+    file_status_t *list;
+    size_t count;
+    size_t next;
+    pthread_mutex_t mutex;
+} status_queue_t;
+
+static void * get_queued_file_statuses(void *arg)
+{
+    status_queue_t *queue = (status_queue_t*)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&queue->mutex);
+        size_t first = queue->next;
+        queue->next += THREAD_CHUNK_SIZE;
+        pthread_mutex_unlock(&queue->mutex);
+        if (first >= queue->count)
+            break;
+        size_t last = first + THREAD_CHUNK_SIZE < queue->count ? first + THREAD_CHUNK_SIZE : queue->count;
+        get_file_statuses_sequentially(queue->list + first, last - first);
+    }
+    return NULL;
+}
+
+static void get_file_statuses_in_parallel(file_status_t *list, size_t count)
+{
+    status_queue_t queue = { list, count, 0 };
+    pthread_mutex_init(&queue.mutex, NULL);
+    size_t threads_count = (count + THREAD_CHUNK_SIZE - 1) / THREAD_CHUNK_SIZE;
+    if (threads_count > MAX_THREADS_COUNT)
+        threads_count = MAX_THREADS_COUNT;
+    pthread_t *threads = nnalloc(sizeof(pthread_t) * threads_count);
+    size_t started = 0;
+    for (; started + 1 < threads_count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, get_queued_file_statuses, &queue) != 0)
+            break;
+    }
+    get_queued_file_statuses(&queue);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&queue.mutex);
+}
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#define RING_ENTRIES 256
+
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} ring_t;
+
+/*
+    The ring is opened once and kept until the end of the process; the first thread that
+    needs it opens it and checks that the kernel supports 'statx' requests, the others
+    use it one at a time
+*/
+static ring_t ring;
+static bool ring_usable = false;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void close_ring(ring_t *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+static void * map_ring(int fd, size_t size, off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static bool open_ring(ring_t *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(ring_t));
+    ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring->fd < 0)
+        return false;
+    ring->entries = params.sq_entries < params.cq_entries ? params.sq_entries : params.cq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    ring->cq_ring = map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes)
+    {
+        close_ring(ring);
+        return false;
+    }
+    char *sq = (char*)ring->sq_ring;
+    char *cq = (char*)ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void prepare_statx_request(unsigned tail, const char *path, struct statx *buffer, size_t index)
+{
+    unsigned position = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[position];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = STATX_MTIME;
+    sqe->off = (uint64_t)(uintptr_t)buffer;
+    sqe->user_data = index;
+    ring.sq_array[position] = position;
+}
+
+/*
+    Returns false if the ring can't do the job, the caller then checks all the files another way.
+    The kernel writes results into the buffers until the requests complete, so every
+    submitted request is waited for, even after a failure
+*/
+static bool get_file_statuses_with_ring(file_status_t *list, size_t count)
+{
+    struct statx *buffers = nnalloc(sizeof(struct statx) * count);
+    size_t prepared = 0;
+    size_t submitted = 0;
+    size_t completed = 0;
+    bool result = true;
+    do
+    {
+        unsigned tail = *ring.sq_tail;
+        while (result && prepared < count && prepared - completed < ring.entries)
+        {
+            prepare_statx_request(tail++, list[prepared].path, &buffers[prepared], prepared);
+            prepared++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+        int entered = (int)syscall(__NR_io_uring_enter, ring.fd, (unsigned)(prepared - submitted), 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if (entered < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // requests in flight can't be waited for, so their buffers are never freed
+            ring_usable = false;
+            if (completed == submitted)
+                free(buffers);
+            return false;
+        }
+        submitted += (size_t)entered;
+        unsigned head = *ring.cq_head;
+        unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            file_status_t *status = &list[cqe->user_data];
+            // kernels that do not know the operation reject it
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                result = false;
+            status->exists = cqe->res == 0;
+            if (status->exists)
+            {
+                struct statx *buffer = &buffers[cqe->user_data];
+                status->time = (file_time_t)buffer->stx_mtime.tv_sec * 1000000000 + buffer->stx_mtime.tv_nsec;
+            }
+            completed++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    while (completed < prepared || (result && prepared < count));
+    free(buffers);
+    return result;
+}
+
+/*
+    A single request tells whether the kernel supports 'statx' in a ring (since 5.6)
+*/
+static void init_ring()
+{
+    if (!open_ring(&ring))
+        return;
+    file_status_t probe = { ".", 0, false };
+    ring_usable = get_file_statuses_with_ring(&probe, 1) && probe.exists;
+    if (!ring_usable)
+        close_ring(&ring);
+}
+
+/*
+    While another thread uses the ring, the files are checked by threads rather than waiting
+*/
+void get_file_statuses(file_status_t *list, size_t count)
+{
+    if (count < MIN_BATCH_SIZE)
+    {
+        get_file_statuses_sequentially(list, count);
+        return;
+    }
+    pthread_once(&ring_once, init_ring);
+    bool done = false;
+    if (pthread_mutex_trylock(&ring_mutex) == 0)
+    {
+        done = ring_usable && get_file_statuses_with_ring(list, count);
+        pthread_mutex_unlock(&ring_mutex);
+    }
+    if (!done)
+        get_file_statuses_in_parallel(list, count);
+}
+
+#else
+
+void get_file_statuses(file_status_t *list, size_t count)
+{
+    if (count < MIN_BATCH_SIZE)
+        get_file_statuses_sequentially(list, count);
+    else
+        get_file_statuses_in_parallel(list, count);
+}
+
+#endif
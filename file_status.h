@@ -0,0 +1,18 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the function that queries modification times of many files at once
+*/
+
+#pragma once
+
+#include "up_to_date.h"
+
+typedef struct
+{
+    const char *path;
+    file_time_t time;
+    bool exists;
+} file_status_t;
+
+void get_file_statuses(file_status_t *list, size_t count);
@@ -2,6 +2,8 @@
     Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
 
     Implementation of the hierarchical folder tree structure
+
+    Folder names are interned in a string pool, so the tree does not own them
 */
 
 #include "folder_tree.h"
@@ -14,19 +16,19 @@ folder_tree_t *create_folder_tree()
     return (folder_tree_t*)create_tree_map((void*)compare_strings);
 }
 
-folder_tree_t *create_folder_subtree(folder_tree_t *tree, string_t *subfolder_name)
+folder_tree_t *create_folder_subtree(folder_tree_t *tree, string_pool_t *pool, string_t *subfolder_name)
 {
     folder_tree_entry_t *entry = get_entry_from_folder_tree(tree, subfolder_name);
     if (entry)
         return entry->subfolders;
     folder_tree_t *subtree = create_folder_tree();
-    add_pair_to_tree_map(&tree->base, duplicate_string(*subfolder_name), subtree);
+    add_pair_to_tree_map(&tree->base, intern_string(pool, *subfolder_name), subtree);
     return subtree;
 }
 
 void destroy_folder_tree(folder_tree_t *tree)
 {
-    destroy_tree_map_and_content(&tree->base, free, (void*)destroy_folder_tree);
+    destroy_tree_map_and_content(&tree->base, NULL, (void*)destroy_folder_tree);
 }
 
 folder_tree_entry_t * get_entry_from_folder_tree(folder_tree_t *tree, string_t *folder_name)
@@ -34,32 +36,21 @@ folder_tree_entry_t * get_entry_from_folder_tree(folder_tree_t *tree, string_t *
     return (folder_tree_entry_t*)get_pair_from_tree_map(&tree->base, folder_name);
 }
 
-static void add_subfolder_to_subtree(folder_tree_t *tree, strings_list_t *list, size_t index)
+void add_folder_to_tree(folder_tree_t *tree, string_pool_t *pool, string_t *path)
 {
-    if (index == list->size)
-        return;
-
-    string_t *subfolder = list->items[index];
-    folder_tree_entry_t *entry = get_entry_from_folder_tree(tree, subfolder);
-    if (entry)
-    {
-        add_subfolder_to_subtree(entry->subfolders, list, index + 1);
-    }
-    else
+    size_t begin = 0;
+    while (begin < path->length)
     {
-        folder_tree_t *subtree = create_folder_tree();
-        add_pair_to_tree_map(&tree->base, duplicate_string(*subfolder), subtree);
-        add_subfolder_to_subtree(subtree, list, index + 1);
+        size_t end = begin;
+        while (end < path->length && path->data[end] != path_separator)
+            end++;
+        string_t subfolder = { path->data + begin, end - begin };
+        if (subfolder.length > 0)
+            tree = create_folder_subtree(tree, pool, &subfolder);
+        begin = end + 1;
     }
 }
 
-void add_folder_to_tree(folder_tree_t *tree, string_t *path)
-{
-    strings_list_t *list = split_string(*path, path_separator);
-    add_subfolder_to_subtree(tree, list, 0);
-    destroy_strings_list(list);
-}
-
 bool make_folders(string_t root, folder_tree_t *tree)
 {
     if (!folder_exists(root.data))
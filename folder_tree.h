@@ -8,6 +8,7 @@
 
 #include "tree_map.h"
 #include "strings.h"
+#include "arena.h"
 
 typedef struct
 {
@@ -21,8 +22,8 @@ typedef struct
 } folder_tree_entry_t;
 
 folder_tree_t *create_folder_tree();
-folder_tree_t *create_folder_subtree(folder_tree_t *tree, string_t *subfolder_name);
+folder_tree_t *create_folder_subtree(folder_tree_t *tree, string_pool_t *pool, string_t *subfolder_name);
 void destroy_folder_tree(folder_tree_t *tree);
 folder_tree_entry_t * get_entry_from_folder_tree(folder_tree_t *tree, string_t *folder_name);
-void add_folder_to_tree(folder_tree_t *tree, string_t *path);
+void add_folder_to_tree(folder_tree_t *tree, string_pool_t *pool, string_t *path);
 bool make_folders(string_t root, folder_tree_t *tree);
\ No newline at end of file
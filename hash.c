@@ -0,0 +1,20 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the hash function (64-bit FNV-1a)
+*/
+
+#include "hash.h"
+
+const uint64_t initial_hash_value = 14695981039346656037ULL;
+
+uint64_t calculate_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
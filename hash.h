@@ -0,0 +1,14 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the hash function used to identify file contents
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern const uint64_t initial_hash_value;
+
+uint64_t calculate_hash(uint64_t hash, const void *data, size_t size);
@@ -0,0 +1,261 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the report that ranks headers by the preprocessing work they cause
+
+    Every translation unit is preprocessed, and the line markers of the output
+    ('# <line> "<file>" <flags>') tell which file each line comes from and how files
+    include each other, like the tree printed by '-H', but together with sizes.
+    For a header, the report gives the number of translation units that include it,
+    the size of the preprocessed text it produces with everything it includes, and
+    the number of files it includes transitively. Headers are ranked by the total
+    size over all translation units, that is, by the work they add to every build.
+*/
+
+#include "header_report.h"
+#include "tree_map.h"
+#include "files.h"
+#include "path.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    string_t *path;
+    size_t units;
+    size_t inclusions;
+    size_t total_size;
+    size_t max_fan_out;
+    size_t last_unit;
+} header_cost_t;
+
+typedef struct
+{
+    string_t *path;
+    header_cost_t *cost;
+    size_t start_size;
+    size_t start_count;
+} include_frame_t;
+
+struct header_report_t
+{
+    tree_map_t *headers;
+    vector_t *frames;
+    size_t depth;
+    size_t units;
+    size_t size;
+    size_t included_files_count;
+};
+
+header_report_t * create_header_report()
+{
+    header_report_t *report = nnalloc(sizeof(header_report_t));
+    report->headers = create_tree_map((void*)compare_strings);
+    report->frames = create_vector();
+    report->depth = 0;
+    report->units = 0;
+    report->size = 0;
+    report->included_files_count = 0;
+    return report;
+}
+
+static bool is_path_in_folder(string_t path, string_t *folder)
+{
+    if (are_strings_equal(*folder, __S(".")))
+        return path.length > 0 && path.data[0] != '/' && path.data[0] != '\\' && (path.length < 2 || path.data[1] != ':');
+    return path.length > folder->length + 1 && 0 == memcmp(path.data, folder->data, folder->length)
+        && (path.data[folder->length] == '/' || path.data[folder->length] == '\\');
+}
+
+static header_cost_t * get_header_cost(header_report_t *report, string_t path, vector_t *header_list)
+{
+    const pair_t *pair = get_pair_from_tree_map(report->headers, &path);
+    if (pair)
+        return (header_cost_t*)pair->value;
+    bool reachable = false;
+    for (size_t i = 0; i < header_list->size && !reachable; i++)
+        reachable = is_path_in_folder(path, (string_t*)header_list->data[i]);
+    if (!reachable)
+        return NULL;
+    header_cost_t *cost = nnalloc(sizeof(header_cost_t));
+    memset(cost, 0, sizeof(header_cost_t));
+    cost->path = duplicate_string(path);
+    add_pair_to_tree_map(report->headers, cost->path, cost);
+    return cost;
+}
+
+static void push_include_frame(header_report_t *report, string_t path, vector_t *header_list)
+{
+    include_frame_t *frame;
+    if (report->depth < report->frames->size)
+    {
+        frame = (include_frame_t*)report->frames->data[report->depth];
+        free(frame->path);
+    }
+    else
+    {
+        frame = nnalloc(sizeof(include_frame_t));
+        add_item_to_vector(report->frames, frame);
+    }
+    report->depth++;
+    frame->path = duplicate_string(path);
+    frame->cost = NULL;
+    frame->start_size = report->size;
+    frame->start_count = report->included_files_count;
+    // the first frame is the translation unit itself
+    if (report->depth > 1)
+    {
+        report->included_files_count++;
+        frame->cost = get_header_cost(report, path, header_list);
+        if (frame->cost)
+        {
+            frame->cost->inclusions++;
+            if (frame->cost->last_unit != report->units)
+            {
+                frame->cost->last_unit = report->units;
+                frame->cost->units++;
+            }
+        }
+    }
+}
+
+static void pop_include_frame(header_report_t *report)
+{
+    include_frame_t *frame = (include_frame_t*)report->frames->data[--report->depth];
+    if (frame->cost)
+    {
+        size_t fan_out = report->included_files_count - frame->start_count - 1;
+        frame->cost->total_size += report->size - frame->start_size;
+        if (fan_out > frame->cost->max_fan_out)
+            frame->cost->max_fan_out = fan_out;
+    }
+}
+
+static size_t find_include_frame(header_report_t *report, string_t path)
+{
+    for (size_t i = report->depth; i > 0; i--)
+    {
+        if (are_strings_equal(*((include_frame_t*)report->frames->data[i - 1])->path, path))
+            return i;
+    }
+    return 0;
+}
+
+/*
+    gcc and clang mark entering a file by the flag 1 and returning to a file by the flag 2;
+    a marker without flags only changes the line, or, for compilers that do not write
+    flags, enters a file that is not being read yet. Pseudo files like '<built-in>'
+    produce no text and are ignored
+*/
+static void process_line_marker(header_report_t *report, string_t line, vector_t *header_list)
+{
+    size_t begin = index_of_char_in_string(line, '"');
+    if (begin == line.length)
+        return;
+    size_t end = begin + 1;
+    while (end < line.length && line.data[end] != '"')
+        end++;
+    if (end == line.length)
+        return;
+    string_t path = { line.data + begin + 1, end - begin - 1 };
+    int flag = atoi(line.data + end + 1);
+    if (flag == 1 || report->depth == 0)
+    {
+        push_include_frame(report, path, header_list);
+        return;
+    }
+    size_t position = find_include_frame(report, path);
+    if (position == 0 && flag != 2)
+    {
+        if (path.length > 0 && path.data[0] != '<')
+            push_include_frame(report, path, header_list);
+        return;
+    }
+    if (position == 0)
+        position = 1;
+    while (report->depth > position)
+        pop_include_frame(report);
+}
+
+bool add_preprocessed_file_to_header_report(header_report_t *report, const char *file_name, vector_t *header_list)
+{
+    string_t *content = read_file_to_string(file_name);
+    if (!content)
+        return false;
+    report->units++;
+    report->depth = 0;
+    size_t index = 0;
+    while (index < content->length)
+    {
+        size_t end = index;
+        while (end < content->length && content->data[end] != '\n')
+            end++;
+        string_t line = { content->data + index, end - index };
+        index = end + 1;
+        if (line.length > 2 && line.data[0] == '#' && line.data[1] == ' ' && line.data[2] >= '0' && line.data[2] <= '9')
+            process_line_marker(report, line, header_list);
+        else
+            report->size += line.length + 1;
+    }
+    while (report->depth > 0)
+        pop_include_frame(report);
+    free(content);
+    return true;
+}
+
+static int compare_header_costs(const void *first, const void *second)
+{
+    const header_cost_t *first_cost = *((const header_cost_t**)first);
+    const header_cost_t *second_cost = *((const header_cost_t**)second);
+    if (first_cost->total_size != second_cost->total_size)
+        return first_cost->total_size > second_cost->total_size ? -1 : 1;
+    return compare_strings(first_cost->path, second_cost->path);
+}
+
+void print_header_report(header_report_t *report)
+{
+    vector_t *list = create_vector();
+    map_iterator_t *iter = create_iterator_from_tree_map(report->headers);
+    while (has_next_pair(iter))
+        add_item_to_vector(list, next_pair(iter)->value);
+    destroy_map_iterator(iter);
+    qsort(list->data, list->size, sizeof(void*), compare_header_costs);
+
+    printf("\n> Headers of %d translation unit(s), %d KB preprocessed, by total preprocessed size:\n",
+        (int)report->units, (int)(report->size / 1024));
+    printf("%10s %8s %8s %10s %8s  %s\n", "total, KB", "share", "units", "size, KB", "fan-out", "header");
+    for (size_t i = 0; i < list->size; i++)
+    {
+        header_cost_t *cost = (header_cost_t*)list->data[i];
+        printf("%10d %7.1f%% %8d %10.1f %8d  %s\n",
+            (int)(cost->total_size / 1024),
+            report->size ? 100.0 * cost->total_size / report->size : 0.0,
+            (int)cost->units,
+            cost->inclusions ? cost->total_size / 1024.0 / cost->inclusions : 0.0,
+            (int)cost->max_fan_out,
+            cost->path->data);
+    }
+    destroy_vector(list);
+}
+
+static void destroy_header_cost(header_cost_t *cost)
+{
+    free(cost->path);
+    free(cost);
+}
+
+static void destroy_include_frame(include_frame_t *frame)
+{
+    free(frame->path);
+    free(frame);
+}
+
+void destroy_header_report(header_report_t *report)
+{
+    destroy_tree_map_and_content(report->headers, NULL, (void*)destroy_header_cost);
+    destroy_vector_and_content(report->frames, (void*)destroy_include_frame);
+    free(report);
+}
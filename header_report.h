@@ -0,0 +1,17 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the report that ranks headers by the preprocessing work they cause
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+typedef struct header_report_t header_report_t;
+
+header_report_t * create_header_report();
+bool add_preprocessed_file_to_header_report(header_report_t *report, const char *file_name, vector_t *header_list);
+void print_header_report(header_report_t *report);
+void destroy_header_report(header_report_t *report);
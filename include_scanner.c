@@ -0,0 +1,393 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the scanner that builds the graph of included files without a compiler
+
+    Sources are read for '#include "..."' and '#include <...>' directives, which are
+    resolved the way the compiler does it: first the folder of the including file
+    (for the quoted form only), then the header folders of the project in order.
+    Directives that are not resolved are system headers and are ignored.
+
+    The graph is explored level by level, and files of one level are read by a pool
+    of threads. Directives of every file are cached together with its modification
+    time, so only changed files are read again. The cache keeps raw directives because
+    the same header may resolve to different files in different projects.
+*/
+
+#include "include_scanner.h"
+#include "tree_map.h"
+#include "tree_set.h"
+#include "files.h"
+#include "path.h"
+#include "up_to_date.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct
+{
+    string_t *path;
+    file_time_t time;
+    vector_t *directives;
+    bool exists;
+    bool checked;
+    bool modified;
+} file_entry_t;
+
+struct include_scanner_t
+{
+    string_t *cache_file;
+    tree_map_t *files;
+    size_t threads_count;
+};
+
+typedef struct
+{
+    vector_t *entries;
+    size_t next;
+    pthread_mutex_t mutex;
+} check_queue_t;
+
+static file_entry_t * get_file_entry(include_scanner_t *scanner, string_t path, bool create)
+{
+    const pair_t *pair = get_pair_from_tree_map(scanner->files, &path);
+    if (pair)
+        return (file_entry_t*)pair->value;
+    if (!create)
+        return NULL;
+    file_entry_t *entry = nnalloc(sizeof(file_entry_t));
+    entry->path = duplicate_string(path);
+    entry->time = 0;
+    entry->directives = NULL;
+    entry->exists = true;
+    entry->checked = false;
+    entry->modified = false;
+    add_pair_to_tree_map(scanner->files, entry->path, entry);
+    return entry;
+}
+
+static void destroy_file_entry(file_entry_t *entry)
+{
+    if (entry->directives)
+        destroy_vector_and_content(entry->directives, free);
+    free(entry->path);
+    free(entry);
+}
+
+static void load_include_cache(include_scanner_t *scanner)
+{
+    string_t *content = read_file_to_string(scanner->cache_file->data);
+    if (!content)
+        return;
+    file_entry_t *entry = NULL;
+    size_t index = 0;
+    while (index < content->length)
+    {
+        size_t end = index;
+        while (end < content->length && content->data[end] != '\n')
+            end++;
+        string_t line = { content->data + index, end - index };
+        index = end + 1;
+        if (line.length == 0)
+        {
+            entry = NULL;
+        }
+        else if (!entry)
+        {
+            // the header of a record is '<time> <path>'
+            size_t space = index_of_char_in_string(line, ' ');
+            if (space == line.length)
+                break;
+            entry = get_file_entry(scanner, (string_t){ line.data + space + 1, line.length - space - 1 }, true);
+            entry->time = (file_time_t)strtoll(line.data, NULL, 10);
+            entry->directives = create_vector();
+        }
+        else
+        {
+            add_item_to_vector(entry->directives, duplicate_string(line));
+        }
+    }
+    free(content);
+}
+
+include_scanner_t * create_include_scanner(string_t *cache_file, size_t threads_count)
+{
+    include_scanner_t *scanner = nnalloc(sizeof(include_scanner_t));
+    scanner->cache_file = duplicate_string(*cache_file);
+    scanner->files = create_tree_map((void*)compare_strings);
+    scanner->threads_count = threads_count > 0 ? threads_count : 1;
+    load_include_cache(scanner);
+    return scanner;
+}
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static vector_t * parse_include_directives(string_t *content)
+{
+    vector_t *directives = create_vector();
+    size_t index = 0;
+    size_t length = content->length;
+    const char *data = content->data;
+    while (index < length)
+    {
+        while (index < length && is_blank(data[index]))
+            index++;
+        if (index < length && data[index] == '#')
+        {
+            index++;
+            while (index < length && is_blank(data[index]))
+                index++;
+            if (index + 7 <= length && 0 == memcmp(data + index, "include", 7))
+            {
+                index += 7;
+                while (index < length && is_blank(data[index]))
+                    index++;
+                char closing = index < length ? (data[index] == '"' ? '"' : (data[index] == '<' ? '>' : 0)) : 0;
+                if (closing)
+                {
+                    size_t begin = index;
+                    index++;
+                    while (index < length && data[index] != closing && data[index] != '\n')
+                        index++;
+                    if (index < length && data[index] == closing && index > begin + 1)
+                        add_item_to_vector(directives, duplicate_string((string_t){ (char*)data + begin, index - begin }));
+                }
+            }
+        }
+        while (index < length && data[index] != '\n')
+            index++;
+        index++;
+    }
+    return directives;
+}
+
+static void check_file_entry(file_entry_t *entry)
+{
+    file_time_t time;
+    entry->checked = true;
+    entry->exists = get_file_modification_time(entry->path->data, &time);
+    if (!entry->exists)
+    {
+        if (entry->directives)
+        {
+            destroy_vector_and_content(entry->directives, free);
+            entry->directives = NULL;
+            entry->modified = true;
+        }
+        return;
+    }
+    if (entry->directives && entry->time == time)
+        return;
+    string_t *content = read_file_to_string(entry->path->data);
+    if (entry->directives)
+        destroy_vector_and_content(entry->directives, free);
+    entry->directives = content ? parse_include_directives(content) : create_vector();
+    entry->time = time;
+    entry->modified = true;
+    free(content);
+}
+
+static void * check_file_entries(void *arg)
+{
+    check_queue_t *queue = (check_queue_t*)arg;
+    while (true)
+    {
+        pthread_mutex_lock(&queue->mutex);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->mutex);
+        if (index >= queue->entries->size)
+            break;
+        check_file_entry((file_entry_t*)queue->entries->data[index]);
+    }
+    return NULL;
+}
+
+static void check_file_entries_in_parallel(include_scanner_t *scanner, vector_t *entries)
+{
+    check_queue_t queue = { entries, 0 };
+    pthread_mutex_init(&queue.mutex, NULL);
+    size_t count = entries->size < scanner->threads_count ? entries->size : scanner->threads_count;
+    pthread_t *threads = nnalloc(sizeof(pthread_t) * count);
+    size_t started = 0;
+    for (; started + 1 < count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, check_file_entries, &queue) != 0)
+            break;
+    }
+    // the calling thread does its share too, so the work is done even if no thread has started
+    check_file_entries(&queue);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&queue.mutex);
+}
+
+static file_entry_t * find_existing_file(include_scanner_t *scanner, string_t *folder, string_t name)
+{
+    string_t *path = are_strings_equal(*folder, __S(".")) ? duplicate_string(name) :
+        create_formatted_string("%S%c%S", *folder, path_separator, name);
+    fix_path_separators(path->data);
+    file_entry_t *entry = get_file_entry(scanner, *path, false);
+    if (!entry || !entry->checked)
+    {
+        file_time_t time;
+        if (get_file_modification_time(path->data, &time))
+            entry = get_file_entry(scanner, *path, true);
+        else
+            entry = NULL;
+    }
+    else if (!entry->exists)
+    {
+        entry = NULL;
+    }
+    free(path);
+    return entry;
+}
+
+static file_entry_t * resolve_include_directive(include_scanner_t *scanner, file_entry_t *including_file,
+        string_t *directive, vector_t *header_list)
+{
+    string_t name = { directive->data + 1, directive->length - 1 };
+    if (directive->data[0] == '"')
+    {
+        size_t index = including_file->path->length;
+        while (index > 0 && including_file->path->data[index - 1] != path_separator)
+            index--;
+        string_t folder = index > 1 ? (string_t){ including_file->path->data, index - 1 } : __S(".");
+        file_entry_t *entry = find_existing_file(scanner, &folder, name);
+        if (entry)
+            return entry;
+    }
+    for (size_t i = 0; i < header_list->size; i++)
+    {
+        file_entry_t *entry = find_existing_file(scanner, (string_t*)header_list->data[i], name);
+        if (entry)
+            return entry;
+    }
+    return NULL;
+}
+
+/*
+    Walks the graph from the given files, passing every reachable entry to the visitor;
+    entries that have not been checked during this run are checked on the way
+*/
+static void walk_include_graph(include_scanner_t *scanner, vector_t *initial_entries, vector_t *header_list,
+        bool check, void (*visitor)(file_entry_t *entry, void *context), void *context)
+{
+    tree_set_t *visited = create_tree_set(NULL);
+    vector_t *level = create_vector();
+    for (size_t i = 0; i < initial_entries->size; i++)
+    {
+        if (add_item_to_tree_set(visited, initial_entries->data[i]))
+            add_item_to_vector(level, initial_entries->data[i]);
+    }
+    while (level->size)
+    {
+        if (check)
+        {
+            vector_t *unchecked = create_vector();
+            for (size_t i = 0; i < level->size; i++)
+            {
+                if (!((file_entry_t*)level->data[i])->checked)
+                    add_item_to_vector(unchecked, level->data[i]);
+            }
+            if (unchecked->size)
+                check_file_entries_in_parallel(scanner, unchecked);
+            destroy_vector(unchecked);
+        }
+        vector_t *next_level = create_vector();
+        for (size_t i = 0; i < level->size; i++)
+        {
+            file_entry_t *entry = (file_entry_t*)level->data[i];
+            if (visitor)
+                visitor(entry, context);
+            if (!entry->exists || !entry->directives)
+                continue;
+            for (size_t j = 0; j < entry->directives->size; j++)
+            {
+                file_entry_t *included = resolve_include_directive(scanner, entry,
+                    (string_t*)entry->directives->data[j], header_list);
+                if (included && add_item_to_tree_set(visited, included))
+                    add_item_to_vector(next_level, included);
+            }
+        }
+        destroy_vector(level);
+        level = next_level;
+    }
+    destroy_vector(level);
+    destroy_tree_set(visited);
+}
+
+void scan_includes(include_scanner_t *scanner, vector_t *file_list, vector_t *header_list)
+{
+    vector_t *entries = create_vector();
+    for (size_t i = 0; i < file_list->size; i++)
+        add_item_to_vector(entries, get_file_entry(scanner, *((string_t*)file_list->data[i]), true));
+    walk_include_graph(scanner, entries, header_list, true, NULL, NULL);
+    destroy_vector(entries);
+}
+
+typedef struct
+{
+    file_entry_t *root;
+    vector_t *list;
+} included_files_t;
+
+static void add_included_file_to_list(file_entry_t *entry, void *context)
+{
+    included_files_t *result = (included_files_t*)context;
+    if (entry != result->root)
+        add_item_to_vector(result->list, entry->path);
+}
+
+vector_t * get_included_files(include_scanner_t *scanner, string_t *file, vector_t *header_list)
+{
+    included_files_t result = { get_file_entry(scanner, *file, true), create_vector() };
+    vector_t *entries = create_vector();
+    add_item_to_vector(entries, result.root);
+    walk_include_graph(scanner, entries, header_list, true, add_included_file_to_list, &result);
+    destroy_vector(entries);
+    return result.list;
+}
+
+void save_include_cache(include_scanner_t *scanner)
+{
+    bool modified = false;
+    map_iterator_t *iter = create_iterator_from_tree_map(scanner->files);
+    while (has_next_pair(iter) && !modified)
+        modified = ((file_entry_t*)next_pair(iter)->value)->modified;
+    destroy_map_iterator(iter);
+    if (!modified)
+        return;
+
+    FILE *stream = fopen(scanner->cache_file->data, "w");
+    if (!stream)
+        return;
+    iter = create_iterator_from_tree_map(scanner->files);
+    while (has_next_pair(iter))
+    {
+        file_entry_t *entry = (file_entry_t*)next_pair(iter)->value;
+        if (!entry->directives)
+            continue;
+        fprintf(stream, "%lld %s\n", (long long)entry->time, entry->path->data);
+        for (size_t i = 0; i < entry->directives->size; i++)
+            fprintf(stream, "%s\n", ((string_t*)entry->directives->data[i])->data);
+        fprintf(stream, "\n");
+        entry->modified = false;
+    }
+    destroy_map_iterator(iter);
+    fclose(stream);
+}
+
+void destroy_include_scanner(include_scanner_t *scanner)
+{
+    destroy_tree_map_and_content(scanner->files, NULL, (void*)destroy_file_entry);
+    free(scanner->cache_file);
+    free(scanner);
+}
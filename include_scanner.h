@@ -0,0 +1,18 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the scanner that builds the graph of included files without a compiler
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+typedef struct include_scanner_t include_scanner_t;
+
+include_scanner_t * create_include_scanner(string_t *cache_file, size_t threads_count);
+void scan_includes(include_scanner_t *scanner, vector_t *file_list, vector_t *header_list);
+vector_t * get_included_files(include_scanner_t *scanner, string_t *file, vector_t *header_list);
+void save_include_cache(include_scanner_t *scanner);
+void destroy_include_scanner(include_scanner_t *scanner);
@@ -0,0 +1,258 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the client and of the server of the GNU make jobserver
+
+    A jobserver is a pipe (or a named fifo) that contains one byte per free job slot.
+    A process owns one implicit slot and reads a byte before starting each additional
+    job, the byte is written back when the job completes. When factory runs under make,
+    it joins the jobserver announced in MAKEFLAGS, otherwise it creates its own one
+    and announces it to the child processes, so nested builds share the slots.
+
+    Bytes are read through a descriptor of our own in the non-blocking mode. The pipe
+    is shared with other processes, so a byte seen by poll() may be taken by another
+    reader before our read(), and a blocking read would wait for a slot forever while
+    the implicit slot of this process may have become free.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "jobserver.h"
+#include "strings.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMPLICIT_TOKEN -1
+#define NO_TOKEN -2
+
+#ifdef _WIN32
+
+jobserver_t * connect_to_jobserver(const char *makeflags)
+{
+    return NULL;
+}
+
+jobserver_t * create_jobserver(size_t slots)
+{
+    return NULL;
+}
+
+int acquire_job_token(jobserver_t *jobserver)
+{
+    return IMPLICIT_TOKEN;
+}
+
+void release_job_token(jobserver_t *jobserver, int token)
+{
+}
+
+void destroy_jobserver(jobserver_t *jobserver)
+{
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+struct jobserver_t
+{
+    int read_fd;
+    int write_fd;
+    int token_fd;
+    bool owns_fds;
+    bool implicit_token_free;
+    pthread_mutex_t mutex;
+};
+
+static jobserver_t * create_jobserver_descriptor(int read_fd, int write_fd, int token_fd, bool owns_fds)
+{
+    jobserver_t *jobserver = nnalloc(sizeof(jobserver_t));
+    jobserver->read_fd = read_fd;
+    jobserver->write_fd = write_fd;
+    jobserver->token_fd = token_fd;
+    jobserver->owns_fds = owns_fds;
+    jobserver->implicit_token_free = true;
+    pthread_mutex_init(&jobserver->mutex, NULL);
+    return jobserver;
+}
+
+static const char * find_option(const char *makeflags, const char *option)
+{
+    size_t length = strlen(option);
+    const char *value = NULL;
+    const char *position = makeflags;
+    // the last occurrence wins, as in make itself
+    while ((position = strstr(position, option)) != NULL)
+    {
+        if (position == makeflags || position[-1] == ' ')
+            value = position + length;
+        position += length;
+    }
+    return value;
+}
+
+static bool is_descriptor_open(int fd)
+{
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+/*
+    The non-blocking flag belongs to the open file, which dup() shares with the
+    original descriptor and with the other processes, and make does not expect it;
+    opening the pipe again creates a new open file
+*/
+static int open_token_descriptor(int fd)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+jobserver_t * connect_to_jobserver(const char *makeflags)
+{
+    if (!makeflags)
+        return NULL;
+    const char *auth = find_option(makeflags, "--jobserver-auth=");
+    if (!auth)
+        auth = find_option(makeflags, "--jobserver-fds=");
+    if (!auth)
+        return NULL;
+
+    if (0 == strncmp(auth, "fifo:", 5))
+    {
+        string_t *path = duplicate_string(_S(auth + 5));
+        char *end = strchr(path->data, ' ');
+        if (end)
+            *end = '\0';
+        int fd = open(path->data, O_RDWR | O_CLOEXEC);
+        int token_fd = fd < 0 ? -1 : open(path->data, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (token_fd < 0)
+        {
+            fprintf(stderr, "Couldn't open the jobserver fifo '%s', the make jobserver is ignored\n", path->data);
+            if (fd >= 0)
+                close(fd);
+            free(path);
+            return NULL;
+        }
+        free(path);
+        printf("> Using the jobserver of the parent make\n");
+        return create_jobserver_descriptor(fd, fd, token_fd, true);
+    }
+
+    int read_fd, write_fd;
+    if (sscanf(auth, "%d,%d", &read_fd, &write_fd) != 2)
+        return NULL;
+    if (!is_descriptor_open(read_fd) || !is_descriptor_open(write_fd))
+    {
+        fprintf(stderr, "The jobserver descriptors are closed (the recipe is not marked with '+'), "
+            "the make jobserver is ignored\n");
+        return NULL;
+    }
+    int token_fd = open_token_descriptor(read_fd);
+    if (token_fd < 0)
+    {
+        fprintf(stderr, "Couldn't open the jobserver pipe in the non-blocking mode, the make jobserver is ignored\n");
+        return NULL;
+    }
+    printf("> Using the jobserver of the parent make\n");
+    return create_jobserver_descriptor(read_fd, write_fd, token_fd, false);
+}
+
+jobserver_t * create_jobserver(size_t slots)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return NULL;
+    int token_fd = open_token_descriptor(fds[0]);
+    if (token_fd < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    for (size_t i = 1; i < slots; i++)
+    {
+        if (write(fds[1], "+", 1) != 1)
+            break;
+    }
+    // the descriptors are inherited by every process started by us
+    const char *makeflags = getenv("MAKEFLAGS");
+    string_t *value = create_formatted_string("%s%s-j%d --jobserver-auth=%d,%d",
+        makeflags ? makeflags : "", makeflags && *makeflags ? " " : "", (int)slots, fds[0], fds[1]);
+    setenv("MAKEFLAGS", value->data, 1);
+    free(value);
+    return create_jobserver_descriptor(fds[0], fds[1], token_fd, true);
+}
+
+int acquire_job_token(jobserver_t *jobserver)
+{
+    if (!jobserver)
+        return IMPLICIT_TOKEN;
+    while (true)
+    {
+        pthread_mutex_lock(&jobserver->mutex);
+        bool implicit = jobserver->implicit_token_free;
+        jobserver->implicit_token_free = false;
+        pthread_mutex_unlock(&jobserver->mutex);
+        if (implicit)
+            return IMPLICIT_TOKEN;
+
+        // wake up from time to time to check whether the implicit token became free
+        struct pollfd pfd = { jobserver->token_fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR)
+            return NO_TOKEN;
+        if (ready <= 0)
+            continue;
+        unsigned char token;
+        ssize_t count = read(jobserver->token_fd, &token, 1);
+        if (count == 1)
+            return token;
+        // another process has taken the byte first
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            continue;
+        return NO_TOKEN;
+    }
+}
+
+void release_job_token(jobserver_t *jobserver, int token)
+{
+    if (!jobserver)
+        return;
+    if (token == IMPLICIT_TOKEN)
+    {
+        pthread_mutex_lock(&jobserver->mutex);
+        jobserver->implicit_token_free = true;
+        pthread_mutex_unlock(&jobserver->mutex);
+    }
+    else if (token >= 0)
+    {
+        unsigned char byte = (unsigned char)token;
+        while (write(jobserver->write_fd, &byte, 1) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+void destroy_jobserver(jobserver_t *jobserver)
+{
+    if (!jobserver)
+        return;
+    close(jobserver->token_fd);
+    if (jobserver->owns_fds)
+    {
+        close(jobserver->read_fd);
+        if (jobserver->write_fd != jobserver->read_fd)
+            close(jobserver->write_fd);
+    }
+    pthread_mutex_destroy(&jobserver->mutex);
+    free(jobserver);
+}
+
+#endif
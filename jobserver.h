@@ -0,0 +1,18 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the client and of the server of the GNU make jobserver
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct jobserver_t jobserver_t;
+
+jobserver_t * connect_to_jobserver(const char *makeflags);
+jobserver_t * create_jobserver(size_t slots);
+int acquire_job_token(jobserver_t *jobserver);
+void release_job_token(jobserver_t *jobserver, int token);
+void destroy_jobserver(jobserver_t *jobserver);
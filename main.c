@@ -1,5 +1,4 @@
 #include "strings.h"
-#include "json.h"
 #include "path.h"
 #include "files.h"
 #include "folders.h"
@@ -13,11 +12,29 @@
 #include "folder_tree.h"
 #include "stdlib_names.h"
 #include "compiler.h"
+#include "scheduler.h"
+#include "remote.h"
+#include "process.h"
+#include "up_to_date.h"
+#include "file_status.h"
+#include "test_runner.h"
+#include "arena.h"
+#include "manifest.h"
+#include "cache.h"
+#include "hash.h"
+#include "memory_usage.h"
+#include "options.h"
+#include "include_scanner.h"
+#include "store.h"
+#include "header_report.h"
+#include "benchmark_runner.h"
+#include "build_history.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <assert.h>
+#include <string.h>
 
 const string_t build_folder_name = { "build", 5 };
 const string_t ext_folder_name = { "ext", 3 };
@@ -28,22 +45,66 @@ const string_t exe_extension =
         {".bin", 4 };
 #endif
 const string_t obj_extension = { ".o", 2 };
+const string_t shared_library_extension =
+#ifdef _WIN32
+	{".dll", 4 };
+#else
+        {".so", 3 };
+#endif
+const string_t project_file_name = { "factory.json", 12 };
+const string_t workspace_file_name = { "workspace.json", 14 };
+const string_t test_durations_file_name = { "test_durations.txt", 18 };
+const string_t memory_usage_file_name = { "memory_usage.txt", 16 };
+const string_t build_history_file_name = { "build_history.txt", 17 };
+const string_t include_cache_file_name = { "include_cache.txt", 17 };
+const string_t log_extension = { ".log", 4 };
+const double default_test_timeout = 60;
+const string_t baseline_extension = { ".baseline", 9 };
+const size_t default_benchmark_runs = 10;
+const size_t default_warmup_runs = 1;
+
+static char path_separator_data[] = { path_separator, '\0' };
+static const string_t path_separator_string = { path_separator_data, 1 };
+
+/*
+    The project model lives until the end of the run, so it is allocated from one arena,
+    and all names and paths in it are interned
+*/
+static arena_t *model = NULL;
+static string_pool_t *model_strings = NULL;
+
+/*
+    The store of dependency repositories is opened when the first dependency is downloaded
+*/
+static dependency_store_t *dependency_store = NULL;
+static bool dependency_store_opened = false;
 
 typedef struct project_descriptor_t project_descriptor_t;
 
+typedef enum
+{
+    change_none,
+    change_dependency,
+    change_sources,
+    change_project
+} change_level_t;
+
 typedef enum
 {
     project_type_application,
-    project_type_library
+    project_type_library,
+    project_type_test,
+    project_type_benchmark,
+    project_type_workspace
 } project_type_t;
 
 struct project_descriptor_t
 {
     tree_node_t                base;
-    wide_string_t             *name;
+    string_t                  *name;
     string_t                  *fixed_name;
-    wide_string_t             *description;
-    wide_string_t             *author;
+    string_t                  *description;
+    string_t                  *author;
     project_type_t             type;
     struct
     {
@@ -66,7 +127,17 @@ struct project_descriptor_t
         string_t             **list;
         size_t                 count;
     } url;
+    struct
+    {
+        string_t             **list;
+        size_t                 count;
+    } shared_targets;
+    compiler_options_t         compiler_options;
     long int                   stdlib_mask;
+    double                     timeout;
+    size_t                     benchmark_runs;
+    size_t                     warmup_runs;
+    change_level_t             change;
     bool                       unresolved;
 };
 
@@ -76,22 +147,55 @@ typedef struct
     source_list_t *source_list;
     vector_t *header_list;
     long int stdlib_mask;
+    size_t first_object;
+    size_t object_count;
+    file_time_t newest_object_time;
+    vector_t *compile_actions;
+    action_t *link_action;
 } project_build_info_t;
 
-json_element_t * read_json_from_file(const char *file_name, bool silent_mode);
-project_descriptor_t * parse_project_descriptor(json_element_t *root, const char *file_name, tree_map_t *all_projects,
+typedef struct
+{
+    string_t *folder;
+    compiler_t *compiler;
+    scheduler_t *scheduler;
+    memory_history_t *memory_history;
+    build_history_t *build_history;
+    include_scanner_t *include_scanner;
+    vector_t *object_file_list;
+    vector_t *project_list;
+    tree_set_t *changed_sources;
+    tree_map_t *file_digests;
+    bool shared_libraries;
+} target_build_info_t;
+
+project_descriptor_t * parse_project_descriptor(manifest_value_t *root, const char *file_name, tree_map_t *all_projects,
     bool is_root, bool is_temporary);
+project_descriptor_t * parse_workspace_descriptor(manifest_value_t *root, const char *file_name, tree_map_t *all_projects);
 project_descriptor_t * get_first_unresolved_project(project_descriptor_t *root_project);
 bool resolve_dependencies(project_descriptor_t *project, tree_map_t *all_projects);
 bool resolve_dependencies(project_descriptor_t *project, tree_map_t *all_projects);
-void destroy_project_descriptor(project_descriptor_t *project);
-bool make_target(string_t target, tree_traversal_result_t * sorted_project_list);
+bool make_target(string_t target, tree_traversal_result_t * sorted_project_list, scheduler_t *scheduler,
+        include_scanner_t *include_scanner, project_descriptor_t *root_project, tree_set_t *changed_sources);
 source_list_t * build_source_list(project_descriptor_t *project, vector_t *object_file_list, folder_tree_t *folder_tree);
 vector_t * build_header_list(project_descriptor_t *project, long int *stdlib_mask);
 project_build_info_t *calculate_project_build_info(project_descriptor_t *project,
         vector_t *object_file_list, folder_tree_t *folder_tree);
 void destroy_project_build_info(project_build_info_t *info);
-void make_project(const compiler_t *compiler, string_t *target_folder, project_build_info_t *info, vector_t *object_file_list);
+void add_project_to_scheduler(target_build_info_t *target, project_build_info_t *info, vector_t *context_list);
+bool finish_projects(vector_t *context_list);
+void update_newest_object_time(target_build_info_t *target, project_build_info_t *info);
+void update_project_change(project_descriptor_t *project);
+bool run_test_projects(target_build_info_t *target);
+bool run_benchmark_projects(target_build_info_t *target);
+vector_t * read_changed_file_list(const char *file_name);
+tree_set_t * calculate_affected_set(tree_traversal_result_t *sorted_project_list, vector_t *changed_files,
+        string_t target, project_descriptor_t *root_project, include_scanner_t *include_scanner,
+        vector_t *changed_source_list);
+void print_affected_set(tree_traversal_result_t *sorted_project_list, vector_t *changed_source_list);
+bool report_header_costs(string_t target, tree_traversal_result_t *sorted_project_list, scheduler_t *scheduler,
+        project_descriptor_t *root_project);
+static int build(options_t *options);
 
 static string_t * make_path_2(string_t first_part, string_t second_part)
 {
@@ -106,14 +210,162 @@ static string_t * make_path_2(string_t first_part, string_t second_part)
     return path;
 }
 
-int main(void)
+static string_t * intern_path_2(string_t first_part, string_t second_part)
+{
+    string_t parts[] = { first_part, path_separator_string, second_part };
+    return intern_concatenated_strings(model_strings, parts, 3);
+}
+
+static bool is_ascii_string(const string_t *str)
+{
+    for (size_t i = 0; i < str->length; i++)
+    {
+        if ((unsigned char)str->data[i] >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+static string_t * intern_ascii_string(const string_t *str, bool *bad_char)
+{
+    if (bad_char && !is_ascii_string(str))
+        *bad_char = true;
+    return intern_string(model_strings, *str);
+}
+
+static string_t * intern_path(const string_t *str, bool *bad_char)
+{
+    if (bad_char && !is_ascii_string(str))
+        *bad_char = true;
+    char foreign_separator = path_separator == '/' ? '\\' : '/';
+    if (index_of_char_in_string(*str, foreign_separator) == str->length)
+        return intern_string(model_strings, *str);
+    string_t *copy = duplicate_string(*str);
+    fix_path_separators(copy->data);
+    string_t *result = intern_string(model_strings, *copy);
+    free(copy);
+    return result;
+}
+
+static full_path_t * intern_full_path(const string_t *str, bool *bad_char)
+{
+    full_path_t *tmp = split_path(*intern_path(str, bad_char));
+    full_path_t *full_path = allocate_from_arena(model, sizeof(full_path_t));
+    full_path->path = intern_string(model_strings, *tmp->path);
+    full_path->file_name = intern_string(model_strings, *tmp->file_name);
+    destroy_full_path(tmp);
+    return full_path;
+}
+
+static bool is_parent_folder_part(string_t part)
 {
-    json_element_t *root = read_json_from_file("factory.json", false);
-    if (!root)
+    return part.length == 2 && part.data[0] == '.' && part.data[1] == '.';
+}
+
+/*
+    A path in a manifest is relative to the folder of the manifest; leading '..' parts
+    take away trailing parts of that folder, so the path stays as short as it can be
+*/
+static string_t * intern_path_relative_to_manifest(const char *file_name, string_t *path)
+{
+    if (path->length > 0 && (path->data[0] == '/' || path->data[0] == '\\' || (path->length > 1 && path->data[1] == ':')))
+        return path;
+    string_t folder = { (char*)file_name, strlen(file_name) };
+    while (folder.length > 0 && folder.data[folder.length - 1] != path_separator)
+        folder.length--;
+    if (folder.length > 0)
+        folder.length--;
+    if (folder.length == 1 && folder.data[0] == '.')
+        folder.length = 0;
+    string_t rest = are_strings_equal(*path, __S(".")) ? (string_t){ path->data, 0 } : *path;
+    while (folder.length > 0 && rest.length >= 2 && is_parent_folder_part((string_t){ rest.data, 2 })
+        && (rest.length == 2 || rest.data[2] == path_separator))
+    {
+        size_t begin = folder.length;
+        while (begin > 0 && folder.data[begin - 1] != path_separator)
+            begin--;
+        if (is_parent_folder_part((string_t){ folder.data + begin, folder.length - begin }))
+            break;
+        folder.length = begin > 0 ? begin - 1 : 0;
+        rest.data += rest.length > 2 ? 3 : 2;
+        rest.length -= rest.length > 2 ? 3 : 2;
+    }
+    if (folder.length == 0)
+        return intern_string(model_strings, rest.length ? rest : __S("."));
+    if (rest.length == 0)
+        return intern_string(model_strings, folder);
+    return intern_path_2(folder, rest);
+}
+
+static bool uses_shared_libraries(project_descriptor_t *root_project, string_t target)
+{
+    for (size_t i = 0; i < root_project->shared_targets.count; i++)
+    {
+        if (are_strings_equal(*root_project->shared_targets.list[i], target))
+            return true;
+    }
+    return false;
+}
+
+static project_descriptor_t * find_project(tree_map_t *all_projects, const char *name)
+{
+    string_t key = _S(name);
+    const pair_t *record = get_pair_from_tree_map(all_projects, &key);
+    if (record)
+        return (project_descriptor_t*)record->value;
+    project_descriptor_t *result = NULL;
+    map_iterator_t *iter = create_iterator_from_tree_map(all_projects);
+    while (has_next_pair(iter) && !result)
+    {
+        project_descriptor_t *project = (project_descriptor_t*)next_pair(iter)->value;
+        if (are_strings_equal(key, *project->fixed_name))
+            result = project;
+    }
+    destroy_map_iterator(iter);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    options_t *options = parse_options(argc, argv);
+    if (!options)
+        return -1;
+    int exit_code = 0;
+    switch (options->mode)
+    {
+        case mode_worker:
+            exit_code = run_remote_worker(options->worker_address);
+            break;
+        case mode_cache_server:
+            exit_code = run_cache_server(options->cache_server_port, options->cache_server_folder);
+            break;
+        case mode_help:
+            print_usage();
+            break;
+        case mode_build:
+            exit_code = build(options);
+            break;
+    }
+    destroy_options(options);
+    return exit_code;
+}
+
+static int build(options_t *options)
+{
+    bool is_workspace = file_exists(workspace_file_name.data);
+    const char *root_file_name = is_workspace ? workspace_file_name.data : project_file_name.data;
+    manifest_t *manifest = load_manifest(root_file_name, false);
+    if (!manifest)
         return -1;
-    tree_map_t *all_projects = create_tree_map((void*)compare_wide_strings);
-    project_descriptor_t * root_project = parse_project_descriptor(root, "factory.json", all_projects, true, false);
-    destroy_json_element(&root->base);
+    int exit_code = -1;
+    manifest_value_t *root = get_manifest_root(manifest);
+    model = create_arena();
+    model_strings = create_string_pool(model);
+    tree_map_t *all_projects = create_tree_map((void*)compare_strings);
+    project_descriptor_t * root_project = is_workspace ?
+        parse_workspace_descriptor(root, root_file_name, all_projects) :
+        parse_project_descriptor(root, root_file_name, all_projects, true, false);
+    unload_manifest(manifest);
     if (!root_project)
         goto cleanup;
 
@@ -129,49 +381,92 @@ int main(void)
         unresolved_project = get_first_unresolved_project(root_project);
     }
 
-    tree_traversal_result_t * sorted_project_list = topological_sort(&root_project->base);
-    make_target(__S("debug"), sorted_project_list);
-    make_target(__S("release"), sorted_project_list);
-    destroy_tree_traversal_result(sorted_project_list);
+    project_descriptor_t *selected_project = root_project;
+    if (options->project)
+    {
+        selected_project = find_project(all_projects, options->project);
+        if (!selected_project)
+        {
+            fprintf(stderr, "Unknown project '%s'\n", options->project);
+            goto cleanup;
+        }
+    }
 
-cleanup:
-    destroy_tree_map_and_content(all_projects, NULL, (void*)destroy_project_descriptor);
-    return 0;
-}
+    tree_traversal_result_t * sorted_project_list = topological_sort(&selected_project->base);
+    string_t *include_cache_file = make_path_2(build_folder_name, include_cache_file_name);
+    include_scanner_t *include_scanner = create_include_scanner(include_cache_file, get_number_of_processors());
+    free(include_cache_file);
+    vector_t *changed_files = NULL;
+    tree_set_t *changed_sources = NULL;
+    if (options->changed_files)
+    {
+        changed_files = read_changed_file_list(options->changed_files);
+        if (!changed_files)
+            goto done;
+        vector_t *changed_source_list = create_vector();
+        changed_sources = calculate_affected_set(sorted_project_list, changed_files,
+            *((string_t*)options->targets->data[0]), root_project, include_scanner, changed_source_list);
+        print_affected_set(sorted_project_list, changed_source_list);
+        destroy_vector(changed_source_list);
+        exit_code = 0;
+        if (!options->build_affected)
+            goto done;
+    }
 
-json_element_t * read_json_from_file(const char *file_name, bool silent_mode)
-{
-    string_t *raw_data = read_file_to_string(file_name);
-    if (!raw_data)
+    if (options->report == report_history)
     {
-        if (!silent_mode)
-            fprintf(stderr,
-                "Can't open file '%s'\n", file_name);
-        return NULL;
+        string_t *target_folder_name = create_target_folder_name(*((string_t*)options->targets->data[0]),
+            &root_project->compiler_options);
+        string_t *build_history_file = create_formatted_string("%S%c%S%c%S", build_folder_name, path_separator,
+            *target_folder_name, path_separator, build_history_file_name);
+        free(target_folder_name);
+        exit_code = print_build_history_report(build_history_file, options->history_window,
+            options->compile_time_limit) ? 0 : -1;
+        free(build_history_file);
+        goto done;
     }
-    wide_string_t *encoded_data = decode_utf8_string(*raw_data);
-    free(raw_data);
-    if (!encoded_data)
+    scheduler_t *scheduler = create_scheduler(get_number_of_processors(), getenv("FACTORY_WORKERS"),
+        getenv("FACTORY_CACHE"));
+    if (options->report == report_headers)
     {
-        if (!silent_mode)
-            fprintf(stderr,
-                "The file '%s' is not encoded by UTF-8\n", file_name);
-        return NULL;
+        exit_code = report_header_costs(*((string_t*)options->targets->data[0]), sorted_project_list, scheduler,
+            root_project) ? 0 : -1;
+        destroy_scheduler(scheduler);
+        goto done;
     }
-    json_error_t json_error;
-    json_element_t *result = parse_json_ext(encoded_data, &json_error);
-    free(encoded_data);
-    if (!result && !silent_mode)
+    exit_code = 0;
+    for (size_t i = 0; i < options->targets->size; i++)
     {
-        wide_string_t *error_wstr = json_error_to_string(&json_error);
-        string_t *error_str = encode_utf8_string(*error_wstr);
-        free(error_wstr);
-        fprintf(stderr,
-            "The file '%s' can't be parsed, %s\n", 
-            file_name, error_str->data);
-        free(error_str);
+        string_t *target = (string_t*)options->targets->data[i];
+        // objects of targets differ, and so do their dependency files
+        if (changed_sources && i > 0)
+        {
+            vector_t *changed_source_list = create_vector();
+            destroy_tree_set(changed_sources);
+            changed_sources = calculate_affected_set(sorted_project_list, changed_files, *target, root_project,
+                include_scanner, changed_source_list);
+            destroy_vector(changed_source_list);
+        }
+        if (!make_target(*target, sorted_project_list, scheduler, include_scanner, root_project, changed_sources))
+            exit_code = -1;
     }
-    return result;
+    destroy_scheduler(scheduler);
+
+done:
+    if (changed_sources)
+        destroy_tree_set(changed_sources);
+    if (changed_files)
+        destroy_vector(changed_files);
+    save_include_cache(include_scanner);
+    destroy_include_scanner(include_scanner);
+    destroy_tree_traversal_result(sorted_project_list);
+
+cleanup:
+    close_dependency_store(dependency_store);
+    destroy_tree_map_and_content(all_projects, NULL, NULL);
+    destroy_string_pool(model_strings);
+    destroy_arena(model);
+    return exit_code;
 }
 
 size_t get_number_of_project_descriptor_children(const tree_node_t *iface)
@@ -192,81 +487,213 @@ static const tree_node_vtbl_t project_descriptor_vtbl =
     get_child_of_project_descriptor
 };
 
-project_descriptor_t * parse_project_descriptor(json_element_t *root, const char *file_name, tree_map_t *all_projects,
+static bool parse_debug_info_option(compiler_options_t *options, const string_t *name)
+{
+    if (are_strings_equal(*name, __S("split")))
+        options->split_debug_info = true;
+    else if (are_strings_equal(*name, __S("compressed")))
+        options->compressed_debug_info = true;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_root_options(manifest_value_t *root, const char *file_name, project_descriptor_t *project)
+{
+    manifest_value_t *elem_shared = get_manifest_member(root, "shared_libraries");
+    if (elem_shared)
+    {
+        if (elem_shared->type == manifest_string)
+        {
+            project->shared_targets.list = allocate_from_arena(model, sizeof(string_t*) * 1);
+            project->shared_targets.list[0] = intern_ascii_string(&elem_shared->data.string_value, NULL);
+            project->shared_targets.count = 1;
+        }
+        else if (elem_shared->type == manifest_array)
+        {
+            size_t count = elem_shared->data.list.count;
+            project->shared_targets.list = allocate_from_arena(model, sizeof(string_t*) * count);
+            for (manifest_value_t *elem_target = elem_shared->data.list.first; elem_target; elem_target = elem_target->next)
+            {
+                if (elem_target->type == manifest_string)
+                {
+                    project->shared_targets.list[project->shared_targets.count++] =
+                        intern_ascii_string(&elem_target->data.string_value, NULL);
+                }
+            }
+        }
+        else
+        {
+            fprintf(stderr,
+                "'%s', expected a target name or a list of target names that use shared libraries\n", file_name);
+            return false;
+        }
+    }
+
+    manifest_value_t *elem_compilers = get_manifest_member(root, "compilers");
+    if (elem_compilers)
+    {
+        if (elem_compilers->type != manifest_object)
+        {
+            fprintf(stderr,
+                "'%s', expected an object that maps target names to compiler names\n", file_name);
+            return false;
+        }
+        size_t count = elem_compilers->data.list.count;
+        project->compiler_options.backends.targets = allocate_from_arena(model, sizeof(string_t*) * count);
+        project->compiler_options.backends.names = allocate_from_arena(model, sizeof(string_t*) * count);
+        for (manifest_value_t *elem_backend = elem_compilers->data.list.first; elem_backend; elem_backend = elem_backend->next)
+        {
+            if (elem_backend->type != manifest_string || !is_known_compiler_backend(elem_backend->data.string_value))
+            {
+                fprintf(stderr,
+                    "'%s', unknown compiler for the '%.*s' target, expected 'gcc', 'clang' or 'tcc'\n",
+                    file_name, (int)elem_backend->key.length, elem_backend->key.data);
+                return false;
+            }
+            size_t index = project->compiler_options.backends.count++;
+            project->compiler_options.backends.targets[index] = intern_ascii_string(&elem_backend->key, NULL);
+            project->compiler_options.backends.names[index] = intern_ascii_string(&elem_backend->data.string_value, NULL);
+        }
+    }
+
+    manifest_value_t *elem_linker = get_manifest_member(root, "linker");
+    if (elem_linker)
+    {
+        if (elem_linker->type != manifest_string || !is_known_linker(elem_linker->data.string_value))
+        {
+            fprintf(stderr,
+                "'%s', unknown linker, expected 'auto', 'bfd', 'gold', 'lld' or 'mold'\n", file_name);
+            return false;
+        }
+        project->compiler_options.linker = intern_ascii_string(&elem_linker->data.string_value, NULL);
+    }
+
+    manifest_value_t *elem_batch = get_manifest_member(root, "batch_compile");
+    if (elem_batch)
+    {
+        if (elem_batch->type != manifest_number || elem_batch->data.number_value < 1)
+        {
+            fprintf(stderr,
+                "'%s', expected the maximum number of sources compiled by one command\n", file_name);
+            return false;
+        }
+        project->compiler_options.batch_size = (size_t)elem_batch->data.number_value;
+    }
+
+    manifest_value_t *elem_debug_info = get_manifest_member(root, "debug_info");
+    if (elem_debug_info)
+    {
+        const string_t *unknown_option = NULL;
+        if (elem_debug_info->type == manifest_string)
+        {
+            if (!parse_debug_info_option(&project->compiler_options, &elem_debug_info->data.string_value))
+                unknown_option = &elem_debug_info->data.string_value;
+        }
+        else if (elem_debug_info->type == manifest_array)
+        {
+            for (manifest_value_t *elem_option = elem_debug_info->data.list.first; elem_option; elem_option = elem_option->next)
+            {
+                if (elem_option->type == manifest_string
+                        && !parse_debug_info_option(&project->compiler_options, &elem_option->data.string_value))
+                {
+                    unknown_option = &elem_option->data.string_value;
+                    break;
+                }
+            }
+        }
+        if (unknown_option)
+        {
+            fprintf(stderr,
+                "'%s', unknown debug info option: '%.*s'\n",
+                file_name, (int)unknown_option->length, unknown_option->data);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+project_descriptor_t * parse_project_descriptor(manifest_value_t *root, const char *file_name, tree_map_t *all_projects,
     bool is_root, bool is_temporary)
 {
-    if (root->base.type != json_object)
+    if (root->type != manifest_object)
     {
         fprintf(stderr,
             "'%s', invalid format, expected a JSON object the contains a project descriptor\n", file_name);
         return NULL;
     }
 
-    json_pair_t *elem_name = get_pair_from_json_object(root->data.object, L"name");
-    if (!elem_name || elem_name->value->base.type != json_string)
+    manifest_value_t *elem_name = get_manifest_member(root, "name");
+    if (!elem_name || elem_name->type != manifest_string)
     {
         fprintf(stderr,
             "'%s', the project descriptor does not contain a name\n", file_name);
         goto error;
     }
-    wide_string_t *project_name = (wide_string_t*)elem_name->value->data.string_value;
+    const string_t *project_name = &elem_name->data.string_value;
+    string_t *name = intern_string(model_strings, *project_name);
 
     if (!is_temporary)
     {
-        const pair_t *record = get_pair_from_tree_map(all_projects, project_name);
+        const pair_t *record = get_pair_from_tree_map(all_projects, name);
         if (record)
             return (project_descriptor_t*)record->value;
     }
 
-    project_descriptor_t *project = nnalloc(sizeof(project_descriptor_t));
+    project_descriptor_t *project = allocate_from_arena(model, sizeof(project_descriptor_t));
     memset(project, 0, sizeof(project_descriptor_t));
     project->base.vtbl = &project_descriptor_vtbl;
-    project->name = duplicate_wide_string(*project_name);
+    project->name = name;
     if (!is_temporary)
         add_pair_to_tree_map(all_projects, project->name, project);
 
-    project->name = duplicate_wide_string(*project_name);
-    project->fixed_name = wide_string_to_string(*project->name, '_', NULL);
-    for (size_t i = 0; i < project->fixed_name->length; i++)
+    // every character, including a multibyte one, that can't be a part of a file name becomes '_'
+    string_t *fixed_name = duplicate_string(*project_name);
+    fixed_name->length = 0;
+    for (size_t i = 0; i < project_name->length; i++)
     {
-        char c = project->fixed_name->data[i];
+        char c = project_name->data[i];
+        if ((c & 0xC0) == 0x80)
+            continue;
         if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
-            project->fixed_name->data[i] = '_';
+            c = '_';
+        fixed_name->data[fixed_name->length++] = c;
     }
+    project->fixed_name = intern_string(model_strings, *fixed_name);
+    free(fixed_name);
 
-    json_pair_t *elem_description = get_pair_from_json_object(root->data.object, L"description");
-    if (elem_description && elem_description->value->base.type == json_string)
-        project->description = duplicate_wide_string(*elem_description->value->data.string_value);
+    manifest_value_t *elem_description = get_manifest_member(root, "description");
+    if (elem_description && elem_description->type == manifest_string)
+        project->description = copy_string_to_arena(model, elem_description->data.string_value);
 
-    json_pair_t *elem_author = get_pair_from_json_object(root->data.object, L"author");
-    if (elem_author && elem_author->value->base.type == json_string)
-        project->author = duplicate_wide_string(*elem_author->value->data.string_value);
+    manifest_value_t *elem_author = get_manifest_member(root, "author");
+    if (elem_author && elem_author->type == manifest_string)
+        project->author = copy_string_to_arena(model, elem_author->data.string_value);
 
-    json_pair_t *elem_type = get_pair_from_json_object(root->data.object, L"type");
+    manifest_value_t *elem_type = get_manifest_member(root, "type");
     if (elem_type)
     {
-        if (elem_type->value->base.type != json_string)
+        if (elem_type->type != manifest_string)
         {
-            wide_string_t *elem_wstr = json_element_to_simple_string(&elem_type->value->base);
-            string_t *elem_str = encode_utf8_string(*elem_wstr);
             fprintf(stderr,
-                "'%s', the project descriptor contains unsupported project type: '%s'\n",
-                file_name, elem_str->data);
-                free(elem_wstr);
-                free(elem_str);
+                "'%s', the project type must be a string\n", file_name);
             goto error;
         }
-        if (are_wide_strings_equal(*elem_type->value->data.string_value, __W(L"application")))
+        string_t type = elem_type->data.string_value;
+        if (are_strings_equal(type, __S("application")))
             project->type = project_type_application;
-        else if (are_wide_strings_equal(*elem_type->value->data.string_value, __W(L"library")))
+        else if (are_strings_equal(type, __S("library")))
             project->type = project_type_library;
+        else if (are_strings_equal(type, __S("test")))
+            project->type = project_type_test;
+        else if (are_strings_equal(type, __S("benchmark")))
+            project->type = project_type_benchmark;
         else
         {
-            string_t *type = encode_utf8_string(*elem_type->value->data.string_value);
             fprintf(stderr,
-                "'%s', the project descriptor contains unsupported project type: '%s'\n",
-                file_name, type->data);
-            free(type);
+                "'%s', the project descriptor contains unsupported project type: '%.*s'\n",
+                file_name, (int)type.length, type.data);
             goto error;
         }
     }
@@ -275,30 +702,26 @@ project_descriptor_t * parse_project_descriptor(json_element_t *root, const char
         project->type = is_root ? project_type_application : project_type_library;
     }
 
-    json_pair_t *elem_sources = get_pair_from_json_object(root->data.object, L"sources");
+    manifest_value_t *elem_sources = get_manifest_member(root, "sources");
     if (elem_sources)
     {
         bool bad_file_name = false;
-        if (elem_sources->value->base.type == json_string)
+        if (elem_sources->type == manifest_string)
         {
-            project->sources.list = nnalloc(sizeof(full_path_t*) * 1);
-            string_t * full_path = wide_string_to_string(*elem_sources->value->data.string_value, '?', &bad_file_name);
-            project->sources.list[0] = split_path(*full_path);
-            free(full_path);
+            project->sources.list = allocate_from_arena(model, sizeof(full_path_t*) * 1);
+            project->sources.list[0] = intern_full_path(&elem_sources->data.string_value, &bad_file_name);
             project->sources.count = 1;
         }
-        else if (elem_sources->value->base.type == json_array)
+        else if (elem_sources->type == manifest_array)
         {
-            size_t count = elem_sources->value->data.array->count;
-            project->sources.list = nnalloc(sizeof(full_path_t*) * count);
-            for (size_t i = 0; i < count; i++)
+            size_t count = elem_sources->data.list.count;
+            project->sources.list = allocate_from_arena(model, sizeof(full_path_t*) * count);
+            for (manifest_value_t *elem_source = elem_sources->data.list.first; elem_source; elem_source = elem_source->next)
             {
-                json_element_t *elem_source = get_element_from_json_array(elem_sources->value->data.array, i);
-                if  (elem_source && elem_source->base.type == json_string)
+                if (elem_source->type == manifest_string)
                 {
-                    string_t * full_path = wide_string_to_string(*elem_source->data.string_value, '?', &bad_file_name);
-                    project->sources.list[project->sources.count++] = split_path(*full_path);
-                    free(full_path);
+                    project->sources.list[project->sources.count++] =
+                        intern_full_path(&elem_source->data.string_value, &bad_file_name);
                 }
                 if (bad_file_name)
                     break;
@@ -312,30 +735,26 @@ project_descriptor_t * parse_project_descriptor(json_element_t *root, const char
         }
     }
 
-    json_pair_t *elem_headers = get_pair_from_json_object(root->data.object, L"headers");
+    manifest_value_t *elem_headers = get_manifest_member(root, "headers");
     if (elem_headers)
     {
         bool bad_folder_name = false;
-        if (elem_headers->value->base.type == json_string)
+        if (elem_headers->type == manifest_string)
         {
-            project->headers.list = nnalloc(sizeof(string_t*) * 1);
-            string_t * header_path = wide_string_to_string(*elem_headers->value->data.string_value, '?', &bad_folder_name);
-            fix_path_separators(header_path->data);
-            project->headers.list[0] = header_path;
+            project->headers.list = allocate_from_arena(model, sizeof(string_t*) * 1);
+            project->headers.list[0] = intern_path(&elem_headers->data.string_value, &bad_folder_name);
             project->headers.count = 1;
         }
-        else if (elem_headers->value->base.type == json_array)
+        else if (elem_headers->type == manifest_array)
         {
-            size_t count = elem_headers->value->data.array->count;
-            project->headers.list = nnalloc(sizeof(string_t*) * count);
-            for (size_t i = 0; i < count; i++)
+            size_t count = elem_headers->data.list.count;
+            project->headers.list = allocate_from_arena(model, sizeof(string_t*) * count);
+            for (manifest_value_t *elem_header = elem_headers->data.list.first; elem_header; elem_header = elem_header->next)
             {
-                json_element_t *elem_header = get_element_from_json_array(elem_headers->value->data.array, i);
-                if  (elem_header && elem_header->base.type == json_string)
+                if (elem_header->type == manifest_string)
                 {
-                    string_t * header_path = wide_string_to_string(*elem_header->data.string_value, '?', &bad_folder_name);
-                    fix_path_separators(header_path->data);
-                    project->headers.list[project->headers.count++] = header_path;
+                    project->headers.list[project->headers.count++] =
+                        intern_path(&elem_header->data.string_value, &bad_folder_name);
                 }
                 if (bad_folder_name)
                     break;
@@ -349,66 +768,64 @@ project_descriptor_t * parse_project_descriptor(json_element_t *root, const char
         }
     }
 
-    json_pair_t *elem_depends = get_pair_from_json_object(root->data.object, L"depends");
+    manifest_value_t *elem_depends = get_manifest_member(root, "depends");
     if (!elem_depends)
-        elem_depends = get_pair_from_json_object(root->data.object, L"dependencies");
+        elem_depends = get_manifest_member(root, "dependencies");
     if (elem_depends)
     {
-        if (elem_depends->value->base.type != json_array)
+        if (elem_depends->type != manifest_array)
         {
             fprintf(stderr,
                 "'%s', invalid format, expected a list of dependencies\n", file_name);
             goto error;
         }
-        size_t count = elem_depends->value->data.array->count;
-        project->depends.list = nnalloc(sizeof(project_descriptor_t*) * count);
-        project->depends.count = count;
-        for (size_t i = 0; i < count; i++)
+        size_t count = elem_depends->data.list.count;
+        project->depends.list = allocate_from_arena(model, sizeof(project_descriptor_t*) * count);
+        for (manifest_value_t *elem_dependency = elem_depends->data.list.first; elem_dependency; elem_dependency = elem_dependency->next)
         {
-            json_element_t *elem_dependency = get_element_from_json_array(elem_depends->value->data.array, i);
             project_descriptor_t *other_project = parse_project_descriptor(elem_dependency, file_name, all_projects, false, false);
             if (!other_project)
                 goto error;
-            project->depends.list[i] = other_project;
+            project->depends.list[project->depends.count++] = other_project;
         }
     }
 
-    json_pair_t *elem_path = get_pair_from_json_object(root->data.object, L"path");
-    if (elem_path && elem_path->value->base.type == json_string)
+    manifest_value_t *elem_path = get_manifest_member(root, "path");
+    if (elem_path && elem_path->type == manifest_string)
     {
         bool bad_folder_name = false;
-        project->path = wide_string_to_string(*elem_path->value->data.string_value, '?', &bad_folder_name);
+        project->path = intern_path(&elem_path->data.string_value, &bad_folder_name);
         if (bad_folder_name)
         {
             fprintf(stderr,
                 "'%s', the project path is incorrect\n", file_name);
             goto error;
         }
-        fix_path_separators(project->path->data);
+        // the path of a root project is relative to its folder already, see 'parse_workspace_project'
+        if (!is_root)
+            project->path = intern_path_relative_to_manifest(file_name, project->path);
     }
 
-    json_pair_t *elem_url = get_pair_from_json_object(root->data.object, L"url");
+    manifest_value_t *elem_url = get_manifest_member(root, "url");
     if (elem_url)
     {
         bool bad_url = false;
-        if (elem_url->value->base.type == json_string)
+        if (elem_url->type == manifest_string)
         {
-            project->url.list = nnalloc(sizeof(string_t*) * 1);
-            string_t * url = wide_string_to_string(*elem_url->value->data.string_value, '#', &bad_url);
-            project->url.list[0] = url;
+            project->url.list = allocate_from_arena(model, sizeof(string_t*) * 1);
+            project->url.list[0] = intern_ascii_string(&elem_url->data.string_value, &bad_url);
             project->url.count = 1;
         }
-        else if (elem_url->value->base.type == json_array)
+        else if (elem_url->type == manifest_array)
         {
-            size_t count = elem_url->value->data.array->count;
-            project->url.list = nnalloc(sizeof(string_t*) * count);
-            for (size_t i = 0; i < count; i++)
+            size_t count = elem_url->data.list.count;
+            project->url.list = allocate_from_arena(model, sizeof(string_t*) * count);
+            for (manifest_value_t *elem_one_url = elem_url->data.list.first; elem_one_url; elem_one_url = elem_one_url->next)
             {
-                json_element_t *elem_one_url = get_element_from_json_array(elem_url->value->data.array, i);
-                if  (elem_one_url && elem_one_url->base.type == json_string)
+                if (elem_one_url->type == manifest_string)
                 {
-                    string_t * url = wide_string_to_string(*elem_one_url->data.string_value, '?', &bad_url);
-                    project->url.list[project->url.count++] = url;
+                    project->url.list[project->url.count++] =
+                        intern_ascii_string(&elem_one_url->data.string_value, &bad_url);
                 }
                 if (bad_url)
                     break;
@@ -422,50 +839,89 @@ project_descriptor_t * parse_project_descriptor(json_element_t *root, const char
         }
     }
 
-    json_pair_t *elem_stdlib = get_pair_from_json_object(root->data.object, L"stdlib");
+    if (is_root && !parse_root_options(root, file_name, project))
+        goto error;
+
+    manifest_value_t *elem_stdlib = get_manifest_member(root, "stdlib");
     if (elem_stdlib)
     {
-        const wide_string_t *unknown_name_wide = NULL;
-        if (elem_stdlib->value->base.type == json_string)
+        const string_t *unknown_name = NULL;
+        if (elem_stdlib->type == manifest_string)
         {
-            stdlib_t lib = parse_stdlib_name(elem_stdlib->value->data.string_value);
+            stdlib_t lib = parse_stdlib_name(&elem_stdlib->data.string_value);
             if (lib == l_unknown)
-                unknown_name_wide = elem_stdlib->value->data.string_value;
+                unknown_name = &elem_stdlib->data.string_value;
             else
                 project->stdlib_mask = 1 << lib;
         }
-        else if (elem_stdlib->value->base.type == json_array)
+        else if (elem_stdlib->type == manifest_array)
         {
-            size_t count = elem_stdlib->value->data.array->count;
-            for (size_t i = 0; i < count; i++)
+            for (manifest_value_t *elem_stdlib_item = elem_stdlib->data.list.first; elem_stdlib_item; elem_stdlib_item = elem_stdlib_item->next)
             {
-                json_element_t *elem_stdlib_item = get_element_from_json_array(elem_stdlib->value->data.array, i);
-                if  (elem_stdlib_item && elem_stdlib_item->base.type == json_string)
+                if (elem_stdlib_item->type == manifest_string)
                 {
-                    stdlib_t lib = parse_stdlib_name(elem_stdlib_item->data.string_value);
+                    stdlib_t lib = parse_stdlib_name(&elem_stdlib_item->data.string_value);
                     if (lib == l_unknown)
-                        unknown_name_wide = elem_stdlib_item->data.string_value;
+                        unknown_name = &elem_stdlib_item->data.string_value;
                     else
                         project->stdlib_mask |= 1 << lib;
                 }
-                if (unknown_name_wide)
+                if (unknown_name)
                     break;
             }
         }
-        if (unknown_name_wide)
+        if (unknown_name)
+        {
+            fprintf(stderr,
+                "'%s', unknown standard library name: '%.*s'\n",
+                file_name, (int)unknown_name->length, unknown_name->data);
+            goto error;
+        }
+    }
+
+    project->timeout = default_test_timeout;
+    manifest_value_t *elem_timeout = get_manifest_member(root, "timeout");
+    if (elem_timeout)
+    {
+        double timeout = elem_timeout->type == manifest_number ? elem_timeout->data.number_value : 0;
+        if (timeout <= 0)
+        {
+            fprintf(stderr,
+                "'%s', the timeout must be a positive number of seconds\n", file_name);
+            goto error;
+        }
+        project->timeout = timeout;
+    }
+
+    project->benchmark_runs = default_benchmark_runs;
+    project->warmup_runs = default_warmup_runs;
+    manifest_value_t *elem_runs = get_manifest_member(root, "runs");
+    if (elem_runs)
+    {
+        if (elem_runs->type != manifest_number || elem_runs->data.number_value < 2)
+        {
+            fprintf(stderr,
+                "'%s', a benchmark needs at least two runs\n", file_name);
+            goto error;
+        }
+        project->benchmark_runs = (size_t)elem_runs->data.number_value;
+    }
+    manifest_value_t *elem_warmup = get_manifest_member(root, "warmup");
+    if (elem_warmup)
+    {
+        if (elem_warmup->type != manifest_number || elem_warmup->data.number_value < 0)
         {
-            string_t *unknown_name = wide_string_to_string(*unknown_name_wide, '?', NULL);
             fprintf(stderr,
-                "'%s', unknown standard library name: '%s'\n", file_name, unknown_name->data);
-            free(unknown_name);
+                "'%s', expected the number of warmup runs\n", file_name);
             goto error;
         }
+        project->warmup_runs = (size_t)elem_warmup->data.number_value;
     }
-    
+
     if (!project->path)
     {
         if (is_root)
-            project->path = duplicate_string(__S("."));
+            project->path = intern_string(model_strings, __S("."));
         else
             project->unresolved = true;        
     }
@@ -504,6 +960,107 @@ error:
     return NULL;
 }
 
+static void move_project_content(project_descriptor_t *project, project_descriptor_t *source)
+{
+    project->sources = source->sources;
+    project->headers = source->headers;
+    project->depends = source->depends;
+
+    project->stdlib_mask = source->stdlib_mask;
+    project->timeout = source->timeout;
+    project->benchmark_runs = source->benchmark_runs;
+    project->warmup_runs = source->warmup_runs;
+}
+
+static project_descriptor_t * parse_workspace_project(string_t *folder, tree_map_t *all_projects)
+{
+    string_t *factory_json_path = make_path_2(*folder, project_file_name);
+    manifest_t *manifest = load_manifest(factory_json_path->data, false);
+    project_descriptor_t *project = NULL;
+    if (manifest)
+    {
+        project = parse_project_descriptor(get_manifest_root(manifest), factory_json_path->data, all_projects, true, true);
+        unload_manifest(manifest);
+    }
+    free(factory_json_path);
+    if (!project)
+        return NULL;
+
+    if (!are_strings_equal(*folder, __S(".")))
+    {
+        project->path = are_strings_equal(*project->path, __S(".")) ?
+            intern_string(model_strings, *folder) : intern_path_2(*folder, *project->path);
+    }
+
+    // the project may already be known as a dependency of another root project
+    const pair_t *record = get_pair_from_tree_map(all_projects, project->name);
+    if (!record)
+    {
+        add_pair_to_tree_map(all_projects, project->name, project);
+        return project;
+    }
+    project_descriptor_t *known_project = (project_descriptor_t*)record->value;
+    if (known_project->unresolved)
+    {
+        move_project_content(known_project, project);
+        known_project->type = project->type;
+        known_project->path = project->path;
+        known_project->unresolved = false;
+    }
+    return known_project;
+}
+
+project_descriptor_t * parse_workspace_descriptor(manifest_value_t *root, const char *file_name, tree_map_t *all_projects)
+{
+    if (root->type != manifest_object)
+    {
+        fprintf(stderr,
+            "'%s', invalid format, expected a JSON object the contains a workspace descriptor\n", file_name);
+        return NULL;
+    }
+
+    manifest_value_t *elem_projects = get_manifest_member(root, "projects");
+    if (!elem_projects || elem_projects->type != manifest_array)
+    {
+        fprintf(stderr,
+            "'%s', the workspace descriptor does not contain a list of projects\n", file_name);
+        return NULL;
+    }
+
+    project_descriptor_t *workspace = allocate_from_arena(model, sizeof(project_descriptor_t));
+    memset(workspace, 0, sizeof(project_descriptor_t));
+    workspace->base.vtbl = &project_descriptor_vtbl;
+    workspace->type = project_type_workspace;
+    workspace->fixed_name = intern_string(model_strings, __S("workspace"));
+    if (!parse_root_options(root, file_name, workspace))
+        return NULL;
+
+    size_t count = elem_projects->data.list.count;
+    workspace->depends.list = allocate_from_arena(model, sizeof(project_descriptor_t*) * count);
+    for (manifest_value_t *elem_folder = elem_projects->data.list.first; elem_folder; elem_folder = elem_folder->next)
+    {
+        if (elem_folder->type != manifest_string)
+        {
+            fprintf(stderr,
+                "'%s', expected a project folder\n", file_name);
+            return NULL;
+        }
+        bool bad_folder_name = false;
+        string_t *folder = intern_path(&elem_folder->data.string_value, &bad_folder_name);
+        if (bad_folder_name)
+        {
+            fprintf(stderr,
+                "'%s', the project folder '%s' is incorrect\n", file_name, folder->data);
+            return NULL;
+        }
+        project_descriptor_t *project = parse_workspace_project(folder, all_projects);
+        if (!project)
+            return NULL;
+        workspace->depends.list[workspace->depends.count++] = project;
+    }
+    return workspace;
+}
+
 project_descriptor_t * get_first_unresolved_project(project_descriptor_t *root_project)
 {
     if (root_project->unresolved)
@@ -548,7 +1105,7 @@ bool resolve_dependencies(project_descriptor_t *project, tree_map_t *all_project
                 return false;
             }
         }
-        project->path = make_path_2(ext_folder_name, *project->fixed_name);
+        project->path = intern_path_2(ext_folder_name, *project->fixed_name);
         bool folder_is_empty = false;
         if (no_folder || !folder_exists(project->path->data))
         {
@@ -573,8 +1130,18 @@ bool resolve_dependencies(project_descriptor_t *project, tree_map_t *all_project
     {
         bool downloaded = false;
         printf("\n> Downloading project '%s'...\n", project->fixed_name->data);
+        if (!dependency_store_opened)
+        {
+            dependency_store = open_dependency_store();
+            dependency_store_opened = true;
+        }
         for (size_t i = 0; i < project->url.count; i++)
         {
+            if (dependency_store && clone_from_dependency_store(dependency_store, project->url.list[i], project->path))
+            {
+                downloaded = true;
+                break;
+            }
             string_t *cmd = create_formatted_string("git clone %S %S", *project->url.list[i], *project->path);
             printf("%s\n", cmd->data);
             int exec_result = system(cmd->data);
@@ -595,29 +1162,16 @@ bool resolve_dependencies(project_descriptor_t *project, tree_map_t *all_project
     if (project->headers.count == 0)
     {
         factory_json_path = make_path_2(*project->path, __S("factory.json"));
-        json_element_t *root = read_json_from_file(factory_json_path->data, false);
-        if (!root)
+        manifest_t *manifest = load_manifest(factory_json_path->data, false);
+        if (!manifest)
             goto error;            
-        project_descriptor_t * tmp_proj = parse_project_descriptor(root, factory_json_path->data, all_projects, true, true);
-        destroy_json_element(&root->base);
+        project_descriptor_t * tmp_proj = parse_project_descriptor(get_manifest_root(manifest),
+            factory_json_path->data, all_projects, true, true);
+        unload_manifest(manifest);
         if (!tmp_proj)
             goto error;
 
-        project->sources = tmp_proj->sources;
-        tmp_proj->sources.list = NULL;
-        tmp_proj->sources.count = 0;
-
-        project->headers = tmp_proj->headers;
-        tmp_proj->headers.list = NULL;
-        tmp_proj->headers.count = 0;
-
-        project->depends = tmp_proj->depends;
-        tmp_proj->depends.list = NULL;
-        tmp_proj->depends.count = 0;
-
-        project->stdlib_mask = tmp_proj->stdlib_mask;
-
-        destroy_project_descriptor(tmp_proj);
+        move_project_content(project, tmp_proj);
     }
 
     assert(project->headers.count > 0);
@@ -633,85 +1187,136 @@ cleanup:
     return result;
 }
 
-void destroy_project_descriptor(project_descriptor_t *project)
-{
-    free(project->name);
-    free(project->fixed_name);
-    free(project->description);
-    free(project->author);
-    for (size_t i = 0; i < project->sources.count; i++)
-        destroy_full_path(project->sources.list[i]);
-    free(project->sources.list);
-    for (size_t i = 0; i < project->headers.count; i++)
-        free(project->headers.list[i]);
-    free(project->headers.list);
-    free(project->path);
-    free(project->depends.list);
-    for (size_t i = 0; i < project->url.count; i++)
-        free(project->url.list[i]);
-    free(project->url.list);
-    free(project);
-}
-
-bool make_target(string_t target, tree_traversal_result_t * sorted_project_list)
+bool make_target(string_t target, tree_traversal_result_t * sorted_project_list, scheduler_t *scheduler,
+        include_scanner_t *include_scanner, project_descriptor_t *root_project, tree_set_t *changed_sources)
 {
     printf("\n> Making target '%s'...\n", target.data);
     size_t count = sorted_project_list->count;
     vector_t *object_file_list = create_vector();
     folder_tree_t *build_folder = create_folder_tree();
-    folder_tree_t *target_folder = create_folder_subtree(build_folder, &target);
+    string_t *target_folder_name = create_target_folder_name(target, &root_project->compiler_options);
+    folder_tree_t *target_folder = create_folder_subtree(build_folder, model_strings, target_folder_name);
 
     vector_t *full_build_info = create_vector_ext(get_system_allocator(), count);
+    bool sources_found = true;
     for (size_t i = 0; i < count; i++)
     {
         project_descriptor_t *project = (project_descriptor_t*)sorted_project_list->list[count - i - 1];
+        if (project->type == project_type_workspace)
+            continue;
         project_build_info_t *info = calculate_project_build_info(project, object_file_list, target_folder);
         add_item_to_vector(full_build_info, info);
+        if (!info->source_list)
+        {
+            fprintf(stderr, "Couldn't build the project '%s'\n", project->fixed_name->data);
+            sources_found = false;
+        }
     } 
+    if (!sources_found)
+    {
+        free(target_folder_name);
+        destroy_vector(object_file_list);
+        destroy_folder_tree(build_folder);
+        destroy_vector_and_content(full_build_info, (void*)destroy_project_build_info);
+        return false;
+    }
 
     make_folders(build_folder_name, build_folder);
-    string_t *target_folder_path = make_path_2(build_folder_name, target);
-    const compiler_t *compiler = get_appropriate_compiler(target);
-    for (size_t i = 0; i < count; i++)
+    target_build_info_t target_info;
+    target_info.folder = make_path_2(build_folder_name, *target_folder_name);
+    free(target_folder_name);
+    target_info.compiler = get_appropriate_compiler(target, &root_project->compiler_options);
+    target_info.scheduler = scheduler;
+    target_info.include_scanner = include_scanner;
+    string_t *memory_usage_file = make_path_2(*target_info.folder, memory_usage_file_name);
+    target_info.memory_history = load_memory_history(memory_usage_file);
+    free(memory_usage_file);
+    string_t *build_history_file = make_path_2(*target_info.folder, build_history_file_name);
+    target_info.build_history = open_build_history(build_history_file);
+    free(build_history_file);
+    target_info.object_file_list = object_file_list;
+    target_info.project_list = full_build_info;
+    target_info.changed_sources = changed_sources;
+    target_info.file_digests = create_tree_map((void*)compare_strings);
+    target_info.shared_libraries = uses_shared_libraries(root_project, target);
+
+    // all projects are planned as one graph of actions, and then it is executed
+    vector_t *context_list = create_vector();
+    for (size_t i = 0; i < full_build_info->size; i++)
     {
-        make_project(compiler, target_folder_path, (project_build_info_t*)full_build_info->data[i], object_file_list);
+        project_build_info_t *info = (project_build_info_t*)full_build_info->data[i];
+        if (target_info.changed_sources)
+            update_project_change(info->project);
+        add_project_to_scheduler(&target_info, info, context_list);
     }
-
-    destroy_vector_and_content(object_file_list, free);
-    free(target_folder_path);
+    bool result = wait_for_actions(scheduler);
+    result = finish_projects(context_list) && result;
+    if (result)
+        result = run_test_projects(&target_info);
+    if (result && are_strings_equal(target, __S("release")))
+        result = run_benchmark_projects(&target_info);
+
+    save_memory_history(target_info.memory_history);
+    destroy_memory_history(target_info.memory_history);
+    save_build_history(target_info.build_history);
+    destroy_build_history(target_info.build_history);
+    destroy_tree_map_and_content(target_info.file_digests, NULL, free);
+    destroy_vector(object_file_list);
+    destroy_compiler(target_info.compiler);
+    free(target_info.folder);
     destroy_folder_tree(build_folder);
     destroy_vector_and_content(full_build_info, (void*)destroy_project_build_info);
-    return true;
+    return result;
 }
 
 static string_t * create_c_file_name(string_t path_prefix, string_t *path, string_t *file_name)
 {
-    string_builder_t *c_name = NULL;
+    string_t parts[5];
+    size_t count = 0;
     if (path_prefix.length > 0 && !are_strings_equal(path_prefix, __S(".")))
-        c_name = append_formatted_string(NULL, "%S%c", path_prefix, path_separator);
+    {
+        parts[count++] = path_prefix;
+        parts[count++] = path_separator_string;
+    }
     if (path->length > 0 && !are_strings_equal(*path, __S(".")))
-        c_name = append_formatted_string(c_name, "%S%c", *path, path_separator);
-    c_name = append_string(c_name, *file_name);
-    return (string_t*)c_name;
+    {
+        parts[count++] = *path;
+        parts[count++] = path_separator_string;
+    }
+    parts[count++] = *file_name;
+    return intern_concatenated_strings(model_strings, parts, count);
 }
 
 static string_t * create_obj_file_name(string_t *project_name, string_t *path, string_t *short_c_name)
 {
     file_name_t *fn = split_file_name(*short_c_name);
-    string_builder_t *obj_name = append_formatted_string(NULL, "%S%c", *project_name, path_separator);
+    string_t parts[6];
+    size_t count = 0;
+    parts[count++] = *project_name;
+    parts[count++] = path_separator_string;
     if (path->length > 0 && !are_strings_equal(*path, __S(".")))
-        obj_name = append_formatted_string(obj_name, "%S%c", *path, path_separator);
-    obj_name = append_formatted_string(obj_name, "%S%S",
-        (fn->extension->length == 0 || are_strings_equal(*fn->extension, __S("c"))) ? *fn->name : *short_c_name,
-        obj_extension);
+    {
+        parts[count++] = *path;
+        parts[count++] = path_separator_string;
+    }
+    parts[count++] = (fn->extension->length == 0 || are_strings_equal(*fn->extension, __S("c"))) ?
+        *fn->name : *short_c_name;
+    parts[count++] = obj_extension;
+    string_t *obj_name = intern_concatenated_strings(model_strings, parts, count);
     destroy_file_name(fn);
-    return (string_t*)obj_name;
+    return obj_name;
+}
+
+static int compare_object_file_names(const void *first, const void *second)
+{
+    return compare_strings(*(const string_t**)first, *(const string_t**)second);
 }
 
 source_list_t * build_source_list(project_descriptor_t *project, vector_t *object_file_list, folder_tree_t *folder_tree)
 {
     source_list_t *source_list = create_source_list();
-    folder_tree_t *project_folder = create_folder_subtree(folder_tree, project->fixed_name);
+    folder_tree_t *project_folder = create_folder_subtree(folder_tree, model_strings, project->fixed_name);
+    vector_t *c_file_list = create_vector();
     for (size_t i = 0; i < project->sources.count; i++)
     {
         full_path_t *fp = project->sources.list[i];
@@ -719,23 +1324,18 @@ source_list_t * build_source_list(project_descriptor_t *project, vector_t *objec
         {
             string_t *c_file = create_c_file_name(*project->path, fp->path, fp->file_name); 
             string_t *obj_file = create_obj_file_name(project->fixed_name, fp->path, fp->file_name);
-            add_source_to_list(source_list, project, c_file, obj_file);
-            add_item_to_vector(object_file_list, duplicate_string(*obj_file));
-            add_folder_to_tree(project_folder, fp->path);
-            if (!file_exists(c_file->data))
-            {
-                fprintf(stderr, "File '%s' not found\n", c_file->data);
-                destroy_source_list(source_list);
-                return NULL;
-            }
+            add_source_to_list(source_list, model, project, c_file, obj_file);
+            add_item_to_vector(object_file_list, obj_file);
+            add_folder_to_tree(project_folder, model_strings, fp->path);
+            add_item_to_vector(c_file_list, c_file);
         }
         else
         {
             file_name_template_t *tmpl = create_file_name_template(*fp->file_name);
-            string_t *folder_path = make_path_2(*project->path, *fp->path);
+            string_t *folder_path = intern_path_2(*project->path, *fp->path);
             DIR *dir = opendir(folder_path->data);
             struct dirent *dent;
-            bool found_files = false;
+            size_t first_object = object_file_list->size;
             if(dir != NULL)
             {
                 while((dent = readdir(dir)) != NULL)
@@ -743,25 +1343,41 @@ source_list_t * build_source_list(project_descriptor_t *project, vector_t *objec
                     string_t file_name = _S(dent->d_name);
                     if (file_name_matches_template(file_name, tmpl))
                     {
-                        found_files = true;
                         string_t *c_file = create_c_file_name(*project->path, fp->path, &file_name);
                         string_t *obj_file = create_obj_file_name(project->fixed_name, fp->path, &file_name);
-                        add_source_to_list(source_list, project, c_file, obj_file);
+                        add_source_to_list(source_list, model, project, c_file, obj_file);
+                        add_item_to_vector(object_file_list, obj_file);
                     }
                 }
                 closedir(dir);
             }
-            free(folder_path);
             destroy_file_name_template(tmpl);
-            if (found_files)
+            if (object_file_list->size > first_object)
             {
-                add_folder_to_tree(project_folder, fp->path);
-                string_t *object_files = create_formatted_string("%S%c%S%c*%S",
-                    *project->fixed_name, path_separator, *fp->path, path_separator, obj_extension);
-                add_item_to_vector(object_file_list, object_files);
+                add_folder_to_tree(project_folder, model_strings, fp->path);
+                // the order of files in a folder is arbitrary, but the order of objects in the output must not be
+                qsort(object_file_list->data + first_object, object_file_list->size - first_object, sizeof(void*),
+                    compare_object_file_names);
             }
         }
     }
+    // explicitly listed sources must exist, they are checked all together
+    file_status_t *statuses = nnalloc(sizeof(file_status_t) * (c_file_list->size ? c_file_list->size : 1));
+    for (size_t i = 0; i < c_file_list->size; i++)
+        statuses[i].path = ((string_t*)c_file_list->data[i])->data;
+    get_file_statuses(statuses, c_file_list->size);
+    for (size_t i = 0; i < c_file_list->size; i++)
+    {
+        if (!statuses[i].exists)
+        {
+            fprintf(stderr, "File '%s' not found\n", statuses[i].path);
+            destroy_source_list(source_list);
+            source_list = NULL;
+            break;
+        }
+    }
+    free(statuses);
+    destroy_vector(c_file_list);
     return source_list;
 }
 
@@ -779,15 +1395,14 @@ static void add_project_headers_to_list(project_descriptor_t *project, vector_t
         {
             for (size_t i = 0; i < project->headers.count; i++)
             {
-                string_t *header = make_path_2(*project->path, *project->headers.list[i]);
-                add_item_to_vector(header_list, header);
+                add_item_to_vector(header_list, intern_path_2(*project->path, *project->headers.list[i]));
             }
         }
         else
         {
             for (size_t i = 0; i < project->headers.count; i++)
             {
-                add_item_to_vector(header_list, duplicate_string(*project->headers.list[i]));
+                add_item_to_vector(header_list, project->headers.list[i]);
             }
         }
     }
@@ -812,7 +1427,12 @@ project_build_info_t *calculate_project_build_info(project_descriptor_t *project
 {
     project_build_info_t *info = nnalloc(sizeof(project_build_info_t));
     info->project = project;
+    info->first_object = object_file_list->size;
     info->source_list = build_source_list(project, object_file_list, folder_tree);
+    info->object_count = object_file_list->size - info->first_object;
+    info->newest_object_time = 0;
+    info->compile_actions = NULL;
+    info->link_action = NULL;
     info->stdlib_mask = 0;
     info->header_list = build_header_list(project, &info->stdlib_mask);
     return info;
@@ -820,39 +1440,1168 @@ project_build_info_t *calculate_project_build_info(project_descriptor_t *project
 
 void destroy_project_build_info(project_build_info_t *info)
 {
-    destroy_source_list(info->source_list);
-    destroy_vector_and_content(info->header_list, free);
+    if (info->compile_actions)
+        destroy_vector(info->compile_actions);
+    if (info->source_list)
+        destroy_source_list(info->source_list);
+    destroy_vector(info->header_list);
     free(info);
 }
 
-void make_project(const compiler_t *compiler, string_t *target_folder, project_build_info_t *info, vector_t *object_file_list)
+static string_t * create_split_debug_info_file_name(string_t *obj_file)
 {
-    // building
-    printf("\n> Building project '%s'...\n", info->project->fixed_name->data);
-    string_t *h_files = compiler->create_include_files_list(info->header_list);
-    source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
-    while(has_next_source_descriptor(iter))
-    {
+    string_t base = { obj_file->data, obj_file->length - obj_extension.length };
+    return create_formatted_string("%S.dwo", base);
+}
+
+/*
+    A remote worker gets the source and every file it includes, as found by the include scanner,
+    whatever their names and folders are; system headers are the worker's own
+*/
+static vector_t * create_list_of_action_inputs(include_scanner_t *include_scanner, string_t *c_file,
+        vector_t *header_list)
+{
+    vector_t *inputs = create_vector();
+    add_item_to_vector(inputs, duplicate_string(*c_file));
+    vector_t *included_files = get_included_files(include_scanner, c_file, header_list);
+    for (size_t i = 0; i < included_files->size; i++)
+        add_item_to_vector(inputs, duplicate_string(*((string_t*)included_files->data[i])));
+    destroy_vector(included_files);
+    return inputs;
+}
+
+static void add_project_libraries_to_list(project_descriptor_t *project, vector_t *library_list, tree_set_t *visited_projects)
+{
+    for (size_t i = 0; i < project->depends.count; i++)
+    {
+        project_descriptor_t *dependency = project->depends.list[i];
+        if (is_there_item_in_tree_set(visited_projects, dependency))
+            continue;
+        add_item_to_tree_set(visited_projects, dependency);
+        if (dependency->type == project_type_library)
+            add_item_to_vector(library_list, dependency->fixed_name);
+        add_project_libraries_to_list(dependency, library_list, visited_projects);
+    }
+}
+
+static vector_t * build_shared_library_list(project_descriptor_t *project)
+{
+    vector_t *library_list = create_vector();
+    tree_set_t *visited_projects = create_tree_set(NULL);
+    add_project_libraries_to_list(project, library_list, visited_projects);
+    destroy_tree_set(visited_projects);
+    return library_list;
+}
+
+static void add_project_to_set(project_descriptor_t *project, tree_set_t *project_set)
+{
+    if (is_there_item_in_tree_set(project_set, project))
+        return;
+    add_item_to_tree_set(project_set, project);
+    for (size_t i = 0; i < project->depends.count; i++)
+        add_project_to_set(project->depends.list[i], project_set);
+}
+
+static void add_project_objects_to_list(target_build_info_t *target, project_build_info_t *info,
+        vector_t *object_list, file_time_t *newest_object_time)
+{
+    for (size_t i = 0; i < info->object_count; i++)
+        add_item_to_vector(object_list, target->object_file_list->data[info->first_object + i]);
+    if (info->newest_object_time > *newest_object_time)
+        *newest_object_time = info->newest_object_time;
+}
+
+static uint64_t calculate_command_hash(string_t *cmd)
+{
+    return calculate_hash(initial_hash_value, cmd->data, cmd->length);
+}
+
+/*
+    A project is relinked and retested if a project it depends on has been compiled,
+    even if that one was not in the affected set; projects come after their dependencies
+*/
+void update_project_change(project_descriptor_t *project)
+{
+    for (size_t i = 0; i < project->depends.count && project->change == change_none; i++)
+    {
+        if (project->depends.list[i]->change != change_none)
+            project->change = change_dependency;
+    }
+}
+
+void update_newest_object_time(target_build_info_t *target, project_build_info_t *info)
+{
+    vector_t *obj_file_list = create_vector();
+    source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
+    while(has_next_source_descriptor(iter))
+    {
         source_descriptor_t *source = get_next_source_descriptor(iter);
-        string_t *obj_file = make_path_2(*target_folder, *source->obj_file);
-        string_t *cmd = compiler->create_cmd_line_compile(source->c_file, h_files, obj_file);
-        printf("%s\n", cmd->data);
-        system(cmd->data);
-        free(cmd);
+        add_item_to_vector(obj_file_list, make_path_2(*target->folder, *source->obj_file));
+    }
+    destroy_source_list_iterator(iter);
+    file_status_t *statuses = nnalloc(sizeof(file_status_t) * (obj_file_list->size ? obj_file_list->size : 1));
+    for (size_t i = 0; i < obj_file_list->size; i++)
+        statuses[i].path = ((string_t*)obj_file_list->data[i])->data;
+    get_file_statuses(statuses, obj_file_list->size);
+    for (size_t i = 0; i < obj_file_list->size; i++)
+    {
+        if (statuses[i].exists && statuses[i].time > info->newest_object_time)
+            info->newest_object_time = statuses[i].time;
+    }
+    free(statuses);
+    destroy_vector_and_content(obj_file_list, free);
+}
+
+/*
+    Everything actions of a project need until the whole target is built
+*/
+typedef struct
+{
+    target_build_info_t *target;
+    project_build_info_t *info;
+    string_t *h_files;
+    vector_t *cache_header_list;
+    bool explicit_inputs;
+    bool batch;
+    bool position_independent;
+    bool cache;
+    bool failed;
+    string_t *output_path;
+    uint64_t link_hash;
+} compile_context_t;
+
+/*
+    Sources of one object folder compiled by one invocation of the compiler
+*/
+typedef struct
+{
+    compile_context_t *ctx;
+    string_t *obj_folder;
+    string_t *root_path;
+    vector_t *c_file_list;
+    vector_t *obj_file_list;
+    file_time_t *obj_times;
+} compile_batch_t;
+
+typedef struct
+{
+    action_t *action;
+    string_t *c_file;
+    compile_batch_t *batch;
+    size_t fan_out;
+} compile_action_t;
+
+/*
+    What the completion of a single compile action needs to know
+*/
+typedef struct
+{
+    compile_context_t *ctx;
+    string_t *c_file;
+    string_t *obj_file;
+    uint64_t command_hash;
+} compile_step_t;
+
+static void destroy_compile_step(compile_step_t *step)
+{
+    free(step->obj_file);
+    free(step);
+}
+
+/*
+    Objects taken from the cache were not compiled, so their duration is not recorded
+*/
+static void complete_compile_action(action_t *action)
+{
+    compile_step_t *step = (compile_step_t*)action->context;
+    target_build_info_t *target = step->ctx->target;
+    if (action->result != 0)
+    {
+        step->ctx->failed = true;
+    }
+    else
+    {
+        write_command_hash(step->obj_file, step->command_hash);
+        if (action->peak_memory)
+            record_peak_memory(target->memory_history, calculate_command_hash(action->cmd), action->peak_memory);
+        if (action->duration > 0)
+            record_build_step(target->build_history, build_step_compile, step->c_file, step->obj_file,
+                action->duration);
+    }
+    destroy_compile_step(step);
+}
+
+typedef struct
+{
+    bool exists;
+    uint64_t hash;
+} file_digest_t;
+
+/*
+    Every file is read once per target, however many objects include it
+*/
+static bool get_file_digest(target_build_info_t *target, string_t *file_name, uint64_t *digest)
+{
+    const pair_t *pair = get_pair_from_tree_map(target->file_digests, file_name);
+    file_digest_t *item;
+    if (pair)
+    {
+        item = (file_digest_t*)pair->value;
+    }
+    else
+    {
+        item = nnalloc(sizeof(file_digest_t));
+        string_t *content = read_file_to_string(file_name->data);
+        item->exists = content != NULL;
+        item->hash = content ? calculate_hash(initial_hash_value, content->data, content->length) : 0;
+        free(content);
+        add_pair_to_tree_map(target->file_digests, file_name, item);
+    }
+    *digest = item->hash;
+    return item->exists;
+}
+
+static bool add_file_to_cache_key(target_build_info_t *target, uint64_t *key, string_t *file_name)
+{
+    uint64_t digest;
+    if (!get_file_digest(target, file_name, &digest))
+        return false;
+    *key = calculate_hash(*key, file_name->data, file_name->length + 1);
+    *key = calculate_hash(*key, &digest, sizeof(digest));
+    return true;
+}
+
+/*
+    The key is made of the command line, the version of the compiler, and the contents
+    of the source and of every file it includes as the include scanner sees it;
+    standard headers are looked for in the folders the compiler searches.
+    It is calculated only for objects that are compiled
+*/
+static bool calculate_cache_key(compile_context_t *ctx, string_t *cmd, string_t *c_file, uint64_t *key)
+{
+    target_build_info_t *target = ctx->target;
+    const compiler_identity_t *identity = target->compiler->get_identity();
+    if (!ctx->cache_header_list)
+    {
+        ctx->cache_header_list = create_vector();
+        for (size_t i = 0; i < ctx->info->header_list->size; i++)
+            add_item_to_vector(ctx->cache_header_list, ctx->info->header_list->data[i]);
+        for (size_t i = 0; i < identity->system_header_list->size; i++)
+            add_item_to_vector(ctx->cache_header_list, identity->system_header_list->data[i]);
+    }
+    *key = calculate_hash(initial_hash_value, cmd->data, cmd->length);
+    *key = calculate_hash(*key, &identity->version_hash, sizeof(identity->version_hash));
+    bool result = add_file_to_cache_key(target, key, c_file);
+    vector_t *included_files = get_included_files(target->include_scanner, c_file, ctx->cache_header_list);
+    for (size_t i = 0; i < included_files->size && result; i++)
+        result = add_file_to_cache_key(target, key, (string_t*)included_files->data[i]);
+    destroy_vector(included_files);
+    return result;
+}
+
+static compile_action_t * create_compile_action(compile_context_t *ctx, string_t *c_file, string_t *obj_file)
+{
+    target_build_info_t *target = ctx->target;
+    compiler_t *compiler = target->compiler;
+    string_t *dep_file = create_dependency_file_name(obj_file);
+    string_t *cmd = compiler->create_cmd_line_compile(compiler, c_file, ctx->h_files, obj_file,
+        ctx->position_independent);
+    compile_step_t *step = nnalloc(sizeof(compile_step_t));
+    step->ctx = ctx;
+    step->c_file = c_file;
+    step->obj_file = duplicate_string(*obj_file);
+    step->command_hash = calculate_command_hash(cmd);
+    vector_t *inputs = NULL;
+    vector_t *outputs = NULL;
+    uint64_t cache_key = 0;
+    bool cacheable = ctx->cache && calculate_cache_key(ctx, cmd, c_file, &cache_key);
+    if (ctx->explicit_inputs)
+    {
+        inputs = create_list_of_action_inputs(target->include_scanner, c_file, ctx->info->header_list);
+        outputs = create_vector();
+        add_item_to_vector(outputs, obj_file);
+        add_item_to_vector(outputs, dep_file);
+        if (compiler->split_debug_info)
+            add_item_to_vector(outputs, create_split_debug_info_file_name(obj_file));
+    }
+    else
+    {
+        free(dep_file);
         free(obj_file);
     }
+    action_t *action = create_action(cmd, inputs, outputs);
+    action->cacheable = cacheable;
+    action->cache_key = cache_key;
+    action->expected_memory = predict_peak_memory(target->memory_history, step->command_hash);
+    action->on_completion = complete_compile_action;
+    action->context = step;
+    compile_action_t *item = nnalloc(sizeof(compile_action_t));
+    item->action = action;
+    item->c_file = c_file;
+    item->batch = NULL;
+    item->fan_out = 0;
+    return item;
+}
+
+/*
+    The path from an object folder back to the root of the workspace, like '../../../'
+*/
+static string_t * create_path_to_root(string_t *folder)
+{
+    string_builder_t *path = NULL;
+    size_t depth = 1;
+    for (size_t i = 0; i < folder->length; i++)
+        depth += (folder->data[i] == path_separator);
+    for (size_t i = 0; i < depth; i++)
+        path = append_formatted_string(path, "..%c", path_separator);
+    return (string_t*)path;
+}
+
+/*
+    Without '-o', the compiler names an object after its source, so only sources
+    whose objects are named the same way can be batched
+*/
+static string_t * get_batch_folder(string_t *c_file, string_t *obj_file)
+{
+    if (c_file->length < 2 || 0 != memcmp(c_file->data + c_file->length - 2, ".c", 2))
+        return NULL;
+    size_t begin = c_file->length;
+    while (begin > 0 && c_file->data[begin - 1] != path_separator)
+        begin--;
+    string_t base = { c_file->data + begin, c_file->length - 2 - begin };
+    size_t obj_name_length = base.length + obj_extension.length;
+    if (obj_file->length <= obj_name_length + 1)
+        return NULL;
+    size_t folder_length = obj_file->length - obj_name_length - 1;
+    if (obj_file->data[folder_length] != path_separator
+            || 0 != memcmp(obj_file->data + folder_length + 1, base.data, base.length)
+            || 0 != memcmp(obj_file->data + folder_length + 1 + base.length, obj_extension.data, obj_extension.length))
+        return NULL;
+    return duplicate_string((string_t){ obj_file->data, folder_length });
+}
+
+/*
+    An object is identified by the command line that compiles it alone, in the form that
+    is used for it: if its folder is compiled in batches, by a batch of this source only.
+    Other sources of a batch do not change the object, but the batch form does, since
+    the compiler sees the source by another path and with another seed
+*/
+static uint64_t calculate_object_command_hash(compile_context_t *ctx, string_t *c_file, string_t *obj_file)
+{
+    compiler_t *compiler = ctx->target->compiler;
+    string_t *obj_folder = ctx->batch ? get_batch_folder(c_file, obj_file) : NULL;
+    string_t *cmd;
+    if (obj_folder)
+    {
+        vector_t *c_file_list = create_vector();
+        add_item_to_vector(c_file_list, c_file);
+        string_t *root_path = create_path_to_root(obj_folder);
+        cmd = compiler->create_cmd_line_compile_batch(compiler, c_file_list, ctx->info->header_list,
+            obj_folder, root_path, ctx->position_independent);
+        free(root_path);
+        destroy_vector(c_file_list);
+        free(obj_folder);
+    }
+    else
+    {
+        cmd = compiler->create_cmd_line_compile(compiler, c_file, ctx->h_files, obj_file,
+            ctx->position_independent);
+    }
+    uint64_t hash = calculate_command_hash(cmd);
+    free(cmd);
+    return hash;
+}
+
+static void destroy_compile_batch(compile_batch_t *batch)
+{
+    free(batch->obj_folder);
+    free(batch->root_path);
+    destroy_vector(batch->c_file_list);
+    destroy_vector_and_content(batch->obj_file_list, free);
+    free(batch->obj_times);
+    free(batch);
+}
+
+static compile_action_t * create_compile_batch_action(compile_context_t *ctx, string_t *obj_folder,
+        vector_t *c_file_list, vector_t *obj_file_list);
+
+/*
+    The compiler writes an object before it starts with the next source, so an object
+    of the batch is built if its time has changed since the batch was planned
+*/
+static bool is_batch_object_built(compile_batch_t *batch, size_t index)
+{
+    file_time_t time;
+    return get_file_modification_time(((string_t*)batch->obj_file_list->data[index])->data, &time)
+        && time != batch->obj_times[index];
+}
+
+/*
+    Objects of a failed batch that have not been built are compiled one by one,
+    and whatever waits for the batch waits for them too
+*/
+static void add_failed_batch_to_scheduler(compile_batch_t *batch, action_t *action)
+{
+    compile_context_t *ctx = batch->ctx;
+    printf("\n> Compiling sources of the failed batch in '%s' one by one...\n", batch->obj_folder->data);
+    for (size_t i = 0; i < batch->obj_file_list->size; i++)
+    {
+        string_t *c_file = (string_t*)batch->c_file_list->data[i];
+        string_t *obj_file = (string_t*)batch->obj_file_list->data[i];
+        if (is_batch_object_built(batch, i))
+        {
+            write_command_hash(obj_file, calculate_object_command_hash(ctx, c_file, obj_file));
+            continue;
+        }
+        vector_t *c_file_list = create_vector();
+        vector_t *obj_file_list = create_vector();
+        add_item_to_vector(c_file_list, c_file);
+        add_item_to_vector(obj_file_list, duplicate_string(*obj_file));
+        compile_action_t *item = create_compile_batch_action(ctx, batch->obj_folder, c_file_list, obj_file_list);
+        add_follow_up_action_to_scheduler(ctx->target->scheduler, item->action, action);
+        free(item);
+    }
+}
+
+/*
+    Dependency files of a batch are written relative to the object folder; a failed batch
+    is not a failure of the build yet, its sources are compiled one by one,
+    so that errors are reported for each file
+*/
+static void complete_compile_batch(action_t *action)
+{
+    compile_batch_t *batch = (compile_batch_t*)action->context;
+    target_build_info_t *target = batch->ctx->target;
+    if (action->result == 0 && action->peak_memory)
+        record_peak_memory(target->memory_history, calculate_command_hash(action->cmd), action->peak_memory);
+    size_t count = batch->obj_file_list->size;
+    for (size_t i = 0; i < count; i++)
+    {
+        string_t *obj_file = (string_t*)batch->obj_file_list->data[i];
+        if (action->result != 0 && !is_batch_object_built(batch, i))
+            continue;
+        string_t *dep_file = create_dependency_file_name(obj_file);
+        rebase_dependency_file(dep_file, obj_file, batch->root_path);
+        free(dep_file);
+        if (action->result != 0)
+            continue;
+        string_t *c_file = (string_t*)batch->c_file_list->data[i];
+        write_command_hash(obj_file, calculate_object_command_hash(batch->ctx, c_file, obj_file));
+        // the compiler does not tell how the time was spent, each source gets an equal share
+        record_build_step(target->build_history, build_step_batched_compile, c_file, obj_file,
+            action->duration / count);
+    }
+    if (action->result != 0 && count == 1)
+    {
+        batch->ctx->failed = true;
+    }
+    else if (action->result != 0)
+    {
+        action->result = 0;
+        add_failed_batch_to_scheduler(batch, action);
+    }
+    destroy_compile_batch(batch);
+}
+
+static compile_action_t * create_compile_batch_action(compile_context_t *ctx, string_t *obj_folder,
+        vector_t *c_file_list, vector_t *obj_file_list)
+{
+    target_build_info_t *target = ctx->target;
+    compiler_t *compiler = target->compiler;
+    compile_batch_t *batch = nnalloc(sizeof(compile_batch_t));
+    batch->ctx = ctx;
+    batch->obj_folder = duplicate_string(*obj_folder);
+    batch->root_path = create_path_to_root(obj_folder);
+    batch->c_file_list = c_file_list;
+    batch->obj_file_list = obj_file_list;
+    batch->obj_times = nnalloc(sizeof(file_time_t) * obj_file_list->size);
+    for (size_t i = 0; i < obj_file_list->size; i++)
+    {
+        if (!get_file_modification_time(((string_t*)obj_file_list->data[i])->data, &batch->obj_times[i]))
+            batch->obj_times[i] = 0;
+    }
+    string_t *cmd = compiler->create_cmd_line_compile_batch(compiler, c_file_list, ctx->info->header_list,
+        obj_folder, batch->root_path, ctx->position_independent);
+    action_t *action = create_action(cmd, NULL, NULL);
+    action->expected_memory = predict_peak_memory(target->memory_history, calculate_command_hash(cmd));
+    action->on_completion = complete_compile_batch;
+    action->context = batch;
+    compile_action_t *item = nnalloc(sizeof(compile_action_t));
+    item->action = action;
+    item->c_file = (string_t*)c_file_list->data[0];
+    item->batch = batch;
+    item->fan_out = 0;
+    return item;
+}
+
+/*
+    Sources of one folder are split into batches so that every local slot still gets work;
+    a single source is compiled as a batch too, so its object does not depend on the split
+*/
+static void add_compile_batches_to_list(compile_context_t *ctx, tree_map_t *batch_folders, vector_t *compile_actions)
+{
+    size_t processors = get_number_of_processors();
+    map_iterator_t *iter = create_iterator_from_tree_map(batch_folders);
+    while (has_next_pair(iter))
+    {
+        const pair_t *pair = next_pair(iter);
+        string_t *obj_folder = (string_t*)pair->key;
+        vector_t *sources = (vector_t*)pair->value;
+        size_t count = sources->size / 2;
+        size_t batch_size = (count + processors - 1) / processors;
+        if (batch_size > ctx->target->compiler->batch_size)
+            batch_size = ctx->target->compiler->batch_size;
+        for (size_t first = 0; first < count; first += batch_size)
+        {
+            size_t last = first + batch_size < count ? first + batch_size : count;
+            vector_t *c_file_list = create_vector();
+            vector_t *obj_file_list = create_vector();
+            for (size_t i = first; i < last; i++)
+            {
+                add_item_to_vector(c_file_list, sources->data[i * 2]);
+                add_item_to_vector(obj_file_list, sources->data[i * 2 + 1]);
+            }
+            add_item_to_vector(compile_actions, create_compile_batch_action(ctx, obj_folder, c_file_list, obj_file_list));
+        }
+        destroy_vector(sources);
+    }
+    destroy_map_iterator(iter);
+}
+
+static int compare_compile_actions_by_fan_out(const void *first, const void *second)
+{
+    const compile_action_t *first_action = *((const compile_action_t**)first);
+    const compile_action_t *second_action = *((const compile_action_t**)second);
+    if (first_action->fan_out != second_action->fan_out)
+        return first_action->fan_out > second_action->fan_out ? -1 : 1;
+    return 0;
+}
+
+static size_t calculate_fan_out(target_build_info_t *target, project_build_info_t *info, string_t *c_file)
+{
+    vector_t *included_files = get_included_files(target->include_scanner, c_file, info->header_list);
+    size_t fan_out = included_files->size;
+    destroy_vector(included_files);
+    return fan_out;
+}
+
+/*
+    Sources that include more headers usually take longer to compile, so they start first
+    and do not end up as the tail of the build; the include scanner tells that before
+    the first compile
+*/
+static void add_compile_actions_to_scheduler(target_build_info_t *target, project_build_info_t *info,
+        vector_t *compile_actions)
+{
+    if (compile_actions->size > 1)
+    {
+        vector_t *file_list = create_vector();
+        for (size_t i = 0; i < compile_actions->size; i++)
+        {
+            compile_action_t *item = (compile_action_t*)compile_actions->data[i];
+            if (item->batch)
+            {
+                for (size_t j = 0; j < item->batch->c_file_list->size; j++)
+                    add_item_to_vector(file_list, item->batch->c_file_list->data[j]);
+            }
+            else
+            {
+                add_item_to_vector(file_list, item->c_file);
+            }
+        }
+        scan_includes(target->include_scanner, file_list, info->header_list);
+        destroy_vector(file_list);
+        for (size_t i = 0; i < compile_actions->size; i++)
+        {
+            compile_action_t *item = (compile_action_t*)compile_actions->data[i];
+            if (item->batch)
+            {
+                for (size_t j = 0; j < item->batch->c_file_list->size; j++)
+                    item->fan_out += calculate_fan_out(target, info, (string_t*)item->batch->c_file_list->data[j]);
+            }
+            else
+            {
+                item->fan_out = calculate_fan_out(target, info, item->c_file);
+            }
+        }
+        qsort(compile_actions->data, compile_actions->size, sizeof(void*), compare_compile_actions_by_fan_out);
+    }
+    for (size_t i = 0; i < compile_actions->size; i++)
+        add_action_to_scheduler(target->scheduler, ((compile_action_t*)compile_actions->data[i])->action);
+}
+
+/*
+    Objects are checked all together, see 'check_object_files'
+*/
+static object_check_t * create_object_check_list(compile_context_t *ctx, size_t *count)
+{
+    target_build_info_t *target = ctx->target;
+    project_build_info_t *info = ctx->info;
+    vector_t *sources = create_vector();
+    source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
+    while(has_next_source_descriptor(iter))
+    {
+        add_item_to_vector(sources, get_next_source_descriptor(iter));
+    }
     destroy_source_list_iterator(iter);
-    free(h_files);
+    object_check_t *checks = nnalloc(sizeof(object_check_t) * (sources->size ? sources->size : 1));
+    for (size_t i = 0; i < sources->size; i++)
+    {
+        source_descriptor_t *source = (source_descriptor_t*)sources->data[i];
+        checks[i].c_file = source->c_file;
+        checks[i].obj_file = make_path_2(*target->folder, *source->obj_file);
+        checks[i].dep_file = create_dependency_file_name(checks[i].obj_file);
+        checks[i].command_hash = calculate_object_command_hash(ctx, checks[i].c_file, checks[i].obj_file);
+    }
+    *count = sources->size;
+    destroy_vector(sources);
+    check_object_files(checks, *count);
+    return checks;
+}
 
-    // linking
-    if (info->project->type == project_type_application)
+static void complete_link_action(action_t *action)
+{
+    compile_context_t *ctx = (compile_context_t*)action->context;
+    if (action->result == 0)
+    {
+        write_command_hash(ctx->output_path, ctx->link_hash);
+        record_build_step(ctx->target->build_history, build_step_link, ctx->output_path, ctx->output_path,
+            action->duration);
+    }
+    else
+        fprintf(stderr, "Couldn't link the project '%s'\n", ctx->info->project->fixed_name->data);
+}
+
+static void add_project_actions_to_list(project_build_info_t *info, vector_t *action_list, bool link_only)
+{
+    if (link_only)
+    {
+        if (info->link_action)
+            add_item_to_vector(action_list, info->link_action);
+        return;
+    }
+    for (size_t i = 0; info->compile_actions && i < info->compile_actions->size; i++)
+        add_item_to_vector(action_list, info->compile_actions->data[i]);
+}
+
+/*
+    The link waits for the compile actions of all objects it takes; in the shared mode,
+    it takes only objects of its project, but waits for the libraries it is linked with
+*/
+static void add_link_action_to_scheduler(compile_context_t *ctx, bool shared_library)
+{
+    target_build_info_t *target = ctx->target;
+    project_build_info_t *info = ctx->info;
+    compiler_t *compiler = target->compiler;
+    string_t *output_file;
+    if (shared_library)
+        output_file = create_formatted_string("lib%S%S", *info->project->fixed_name, shared_library_extension);
+    else
+        output_file = create_formatted_string("%S%S", *info->project->fixed_name, exe_extension);
+    string_t *output_path = make_path_2(*target->folder, *output_file);
+
+    // in the shared mode, a change in a library relinks only that library,
+    // otherwise an application takes the objects of all projects it depends on
+    vector_t *object_list = create_vector();
+    vector_t *dependencies = create_vector();
+    file_time_t newest_object_time = 0;
+    tree_set_t *project_set = create_tree_set(NULL);
+    add_project_to_set(info->project, project_set);
+    if (target->shared_libraries)
+        add_project_objects_to_list(target, info, object_list, &newest_object_time);
+    for (size_t i = 0; i < target->project_list->size; i++)
+    {
+        project_build_info_t *other = (project_build_info_t*)target->project_list->data[i];
+        if (!is_there_item_in_tree_set(project_set, other->project))
+            continue;
+        if (!target->shared_libraries)
+            add_project_objects_to_list(target, other, object_list, &newest_object_time);
+        add_project_actions_to_list(other, dependencies, target->shared_libraries && other != info);
+    }
+    destroy_tree_set(project_set);
+    bool objects_changed = target->shared_libraries ?
+        info->compile_actions && info->compile_actions->size > 0 :
+        dependencies->size > 0;
+
+    vector_t *library_list = target->shared_libraries ? build_shared_library_list(info->project) : NULL;
+    string_t *cmd;
+    if (shared_library)
+        cmd = compiler->create_cmd_line_link_shared_library(compiler, target->folder, object_list,
+            library_list, info->stdlib_mask, output_file);
+    else
+        cmd = compiler->create_cmd_line_link(compiler, target->folder, object_list,
+            library_list, info->stdlib_mask, output_file);
+    if (library_list)
+        destroy_vector(library_list);
+    // objects are listed in a response file, not in the command line
+    uint64_t link_hash = calculate_command_hash(cmd);
+    for (size_t i = 0; i < object_list->size; i++)
+    {
+        string_t *obj_file = (string_t*)object_list->data[i];
+        link_hash = calculate_hash(link_hash, obj_file->data, obj_file->length + 1);
+    }
+
+    file_time_t output_time;
+    uint64_t previous_link_hash;
+    if (objects_changed || !get_file_modification_time(output_path->data, &output_time)
+            || output_time < newest_object_time || !read_command_hash(output_path, &previous_link_hash)
+            || previous_link_hash != link_hash)
+    {
+        remove_command_hash(output_path);
+        write_response_file(target->folder, object_list, output_file);
+        action_t *action = create_action(cmd, NULL, NULL);
+        action->on_completion = complete_link_action;
+        action->context = ctx;
+        for (size_t i = 0; i < dependencies->size; i++)
+            add_action_dependency(target->scheduler, action, (action_t*)dependencies->data[i]);
+        ctx->output_path = output_path;
+        ctx->link_hash = link_hash;
+        info->link_action = action;
+        add_action_to_scheduler(target->scheduler, action);
+    }
+    else
     {
-        printf("\n> Linking...\n");
-        string_t *exe_file = create_formatted_string("%S%S", *info->project->fixed_name, exe_extension);
-        string_t *cmd = compiler->create_cmd_line_link(target_folder, object_file_list, info->stdlib_mask, exe_file);
-        printf("%s\n", cmd->data);
-        system(cmd->data);
         free(cmd);
-        free(exe_file);
+        free(output_path);
+    }
+    destroy_vector(dependencies);
+    destroy_vector(object_list);
+    free(output_file);
+}
+
+/*
+    Compiles of the project start at once, since they need only headers of the projects
+    it depends on; only links wait for their inputs
+*/
+void add_project_to_scheduler(target_build_info_t *target, project_build_info_t *info, vector_t *context_list)
+{
+    printf("\n> Building project '%s'...\n", info->project->fixed_name->data);
+    compiler_t *compiler = target->compiler;
+    compile_context_t *ctx = nnalloc(sizeof(compile_context_t));
+    ctx->target = target;
+    ctx->info = info;
+    ctx->position_independent = target->shared_libraries && info->project->type == project_type_library;
+    ctx->h_files = compiler->create_include_files_list(info->header_list);
+    ctx->cache = scheduler_has_object_cache(target->scheduler);
+    ctx->explicit_inputs = ctx->cache || scheduler_has_remote_slots(target->scheduler);
+    ctx->cache_header_list = NULL;
+    // the cache and remote workers deal with single objects
+    ctx->batch = compiler->batch_size > 1 && compiler->create_cmd_line_compile_batch && !ctx->explicit_inputs;
+    ctx->failed = false;
+    ctx->output_path = NULL;
+    ctx->link_hash = 0;
+    add_item_to_vector(context_list, ctx);
+    tree_map_t *batch_folders = create_tree_map((void*)compare_strings);
+    vector_t *compile_actions = create_vector();
+    size_t checks_count;
+    object_check_t *checks = create_object_check_list(ctx, &checks_count);
+    if (ctx->explicit_inputs)
+    {
+        // inputs of all objects to be compiled are scanned together, in parallel
+        vector_t *file_list = create_vector();
+        for (size_t i = 0; i < checks_count; i++)
+        {
+            if (!checks[i].up_to_date)
+                add_item_to_vector(file_list, checks[i].c_file);
+        }
+        scan_includes(target->include_scanner, file_list, info->header_list);
+        destroy_vector(file_list);
+    }
+    for (size_t i = 0; i < checks_count; i++)
+    {
+        string_t *c_file = checks[i].c_file;
+        string_t *obj_file = checks[i].obj_file;
+        free(checks[i].dep_file);
+        if (checks[i].up_to_date)
+        {
+            free(obj_file);
+            continue;
+        }
+        // an object that is out of date is compiled even if the source is not affected
+        if (target->changed_sources && info->project->change < change_sources)
+            info->project->change = change_sources;
+        remove_command_hash(obj_file);
+        string_t *obj_folder = ctx->batch ? get_batch_folder(c_file, obj_file) : NULL;
+        if (!obj_folder)
+        {
+            add_item_to_vector(compile_actions, create_compile_action(ctx, c_file, obj_file));
+            continue;
+        }
+        // sources and objects of a folder go in pairs
+        const pair_t *pair = get_pair_from_tree_map(batch_folders, obj_folder);
+        vector_t *sources;
+        if (pair)
+        {
+            sources = (vector_t*)pair->value;
+            free(obj_folder);
+        }
+        else
+        {
+            sources = create_vector();
+            add_pair_to_tree_map(batch_folders, obj_folder, sources);
+        }
+        add_item_to_vector(sources, c_file);
+        add_item_to_vector(sources, obj_file);
+    }
+    free(checks);
+    add_compile_batches_to_list(ctx, batch_folders, compile_actions);
+    destroy_tree_map_and_content(batch_folders, free, NULL);
+    info->compile_actions = create_vector();
+    for (size_t i = 0; i < compile_actions->size; i++)
+        add_item_to_vector(info->compile_actions, ((compile_action_t*)compile_actions->data[i])->action);
+    update_newest_object_time(target, info);
+    add_compile_actions_to_scheduler(target, info, compile_actions);
+    destroy_vector_and_content(compile_actions, free);
+
+    // linking
+    if (info->project->type == project_type_application || info->project->type == project_type_test
+            || info->project->type == project_type_benchmark)
+        add_link_action_to_scheduler(ctx, false);
+    else if (target->shared_libraries)
+        add_link_action_to_scheduler(ctx, true);
+}
+
+/*
+    Called when all actions are completed
+*/
+bool finish_projects(vector_t *context_list)
+{
+    bool result = true;
+    for (size_t i = 0; i < context_list->size; i++)
+    {
+        compile_context_t *ctx = (compile_context_t*)context_list->data[i];
+        if (ctx->failed)
+        {
+            fprintf(stderr, "Couldn't build the project '%s'\n", ctx->info->project->fixed_name->data);
+            result = false;
+        }
+        if (ctx->cache_header_list)
+            destroy_vector(ctx->cache_header_list);
+        free(ctx->h_files);
+        free(ctx->output_path);
+        free(ctx);
+    }
+    destroy_vector(context_list);
+    return result;
+}
+
+bool run_test_projects(target_build_info_t *target)
+{
+    vector_t *test_list = create_vector();
+    for (size_t i = 0; i < target->project_list->size; i++)
+    {
+        project_descriptor_t *project = ((project_build_info_t*)target->project_list->data[i])->project;
+        if (project->type != project_type_test || (target->changed_sources && project->change == change_none))
+            continue;
+        string_t *exe_file = create_formatted_string("%S%c%S%S",
+            *target->folder, path_separator, *project->fixed_name, exe_extension);
+        string_t *log_file = create_formatted_string("%S%c%S%S",
+            *target->folder, path_separator, *project->fixed_name, log_extension);
+        add_item_to_vector(test_list, create_test_descriptor(duplicate_string(*project->fixed_name),
+            exe_file, log_file, project->timeout));
+    }
+    string_t *durations_file = make_path_2(*target->folder, test_durations_file_name);
+    bool result = run_tests(target->scheduler, test_list, durations_file);
+    free(durations_file);
+    destroy_vector_and_content(test_list, (void*)destroy_test_descriptor);
+    return result;
+}
+
+/*
+    Benchmarks are measured only with the optimizing compiler, each against the baseline
+    kept in the project folder, so it survives a clean build and can be committed
+*/
+bool run_benchmark_projects(target_build_info_t *target)
+{
+    vector_t *benchmark_list = create_vector();
+    for (size_t i = 0; i < target->project_list->size; i++)
+    {
+        project_descriptor_t *project = ((project_build_info_t*)target->project_list->data[i])->project;
+        if (project->type != project_type_benchmark || (target->changed_sources && project->change == change_none))
+            continue;
+        string_t *exe_file = create_formatted_string("%S%c%S%S",
+            *target->folder, path_separator, *project->fixed_name, exe_extension);
+        string_t *log_file = create_formatted_string("%S%c%S%S",
+            *target->folder, path_separator, *project->fixed_name, log_extension);
+        string_t *baseline_file = create_formatted_string("%S%c%S%S",
+            *project->path, path_separator, *project->fixed_name, baseline_extension);
+        add_item_to_vector(benchmark_list, create_benchmark_descriptor(duplicate_string(*project->fixed_name),
+            exe_file, log_file, baseline_file, project->timeout, project->benchmark_runs, project->warmup_runs));
+    }
+    bool result = run_benchmarks(benchmark_list);
+    destroy_vector_and_content(benchmark_list, (void*)destroy_benchmark_descriptor);
+    return result;
+}
+
+vector_t * read_changed_file_list(const char *file_name)
+{
+    bool from_stdin = 0 == strcmp(file_name, "-");
+    FILE *stream = from_stdin ? stdin : fopen(file_name, "r");
+    if (!stream)
+    {
+        fprintf(stderr, "Couldn't read the list of changed files '%s'\n", file_name);
+        return NULL;
+    }
+    vector_t *list = create_vector();
+    char line[4096];
+    while (fgets(line, sizeof(line), stream))
+    {
+        string_t path = _S(line);
+        while (path.length > 0 && (unsigned char)path.data[path.length - 1] <= ' ')
+            path.length--;
+        while (path.length > 0 && (unsigned char)path.data[0] <= ' ')
+        {
+            path.data++;
+            path.length--;
+        }
+        while (path.length > 2 && path.data[0] == '.' && (path.data[1] == '/' || path.data[1] == '\\'))
+        {
+            path.data += 2;
+            path.length -= 2;
+        }
+        if (path.length > 0)
+            add_item_to_vector(list, intern_path(&path, NULL));
+    }
+    if (!from_stdin)
+        fclose(stream);
+    return list;
+}
+
+static bool is_header_file(string_t *file)
+{
+    return file->length > 2 && file->data[file->length - 2] == '.' && file->data[file->length - 1] == 'h';
+}
+
+/*
+    The dependency file of a previous build tells which headers an object includes,
+    without it the include scanner does
+*/
+static bool does_object_include_header(string_t *target_folder, include_scanner_t *include_scanner,
+        project_build_info_t *info, source_descriptor_t *source, string_t *header)
+{
+    string_t *obj_file = make_path_2(*target_folder, *source->obj_file);
+    string_t *dep_file = create_dependency_file_name(obj_file);
+    vector_t *prerequisites = read_dependency_file(dep_file->data);
+    free(dep_file);
+    free(obj_file);
+    bool result = false;
+    if (!prerequisites)
+    {
+        vector_t *included_files = get_included_files(include_scanner, source->c_file, info->header_list);
+        for (size_t i = 0; i < included_files->size && !result; i++)
+            result = are_strings_equal(*((string_t*)included_files->data[i]), *header);
+        destroy_vector(included_files);
+        return result;
+    }
+    for (size_t i = 0; i < prerequisites->size && !result; i++)
+    {
+        string_t *item = (string_t*)prerequisites->data[i];
+        string_t path = *item;
+        while (path.length > 2 && path.data[0] == '.' && path.data[1] == path_separator)
+        {
+            path.data += 2;
+            path.length -= 2;
+        }
+        result = are_strings_equal(path, *header);
+    }
+    destroy_vector_and_content(prerequisites, free);
+    return result;
+}
+
+static void mark_changed_file(project_build_info_t *info, string_t *changed_file, string_t *target_folder,
+        include_scanner_t *include_scanner, tree_set_t *changed_sources, vector_t *changed_source_list)
+{
+    project_descriptor_t *project = info->project;
+    string_t no_path = __S("");
+    string_t *manifest = create_c_file_name(*project->path, &no_path, (string_t*)&project_file_name);
+    if (are_strings_equal(*changed_file, *manifest))
+    {
+        project->change = change_project;
+        return;
     }
+    bool is_header = is_header_file(changed_file);
+    source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
+    while(has_next_source_descriptor(iter))
+    {
+        source_descriptor_t *source = get_next_source_descriptor(iter);
+        bool changed = is_header ? does_object_include_header(target_folder, include_scanner, info, source, changed_file) :
+            are_strings_equal(*changed_file, *source->c_file);
+        if (changed)
+        {
+            if (add_item_to_tree_set(changed_sources, source->c_file))
+                add_item_to_vector(changed_source_list, source);
+            if (project->change < change_sources)
+                project->change = change_sources;
+        }
+    }
+    destroy_source_list_iterator(iter);
+}
+
+/*
+    A changed source recompiles its object, a changed header recompiles the objects
+    that include it, and a changed manifest rebuilds its project. Every project
+    that depends on an affected one is relinked and retested.
+*/
+tree_set_t * calculate_affected_set(tree_traversal_result_t *sorted_project_list, vector_t *changed_files,
+        string_t target, project_descriptor_t *root_project, include_scanner_t *include_scanner,
+        vector_t *changed_source_list)
+{
+    tree_set_t *changed_sources = create_tree_set(NULL);
+    string_t *target_folder_name = create_target_folder_name(target, &root_project->compiler_options);
+    string_t *target_folder = make_path_2(build_folder_name, *target_folder_name);
+    free(target_folder_name);
+    vector_t *object_file_list = create_vector();
+    folder_tree_t *folder_tree = create_folder_tree();
+    size_t count = sorted_project_list->count;
+    for (size_t i = 0; i < count; i++)
+    {
+        project_descriptor_t *project = (project_descriptor_t*)sorted_project_list->list[count - i - 1];
+        project->change = change_none;
+        if (project->type == project_type_workspace)
+            continue;
+        project_build_info_t *info = calculate_project_build_info(project, object_file_list, folder_tree);
+        if (info->source_list)
+        {
+            for (size_t j = 0; j < changed_files->size && project->change != change_project; j++)
+                mark_changed_file(info, (string_t*)changed_files->data[j], target_folder, include_scanner,
+                    changed_sources, changed_source_list);
+        }
+        else
+        {
+            project->change = change_project;
+        }
+        destroy_project_build_info(info);
+        update_project_change(project);
+    }
+    destroy_folder_tree(folder_tree);
+    destroy_vector(object_file_list);
+    free(target_folder);
+    return changed_sources;
+}
+
+void print_affected_set(tree_traversal_result_t *sorted_project_list, vector_t *changed_source_list)
+{
+    printf("\n> Affected projects:\n");
+    size_t count = sorted_project_list->count;
+    size_t affected_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        project_descriptor_t *project = (project_descriptor_t*)sorted_project_list->list[count - i - 1];
+        if (project->type == project_type_workspace || project->change == change_none)
+            continue;
+        affected_count++;
+        printf("%s:", project->fixed_name->data);
+        if (project->change == change_project)
+            printf(" rebuild");
+        else if (project->change == change_sources)
+            printf(" compile");
+        if (project->type != project_type_library)
+            printf(" link");
+        if (project->type == project_type_test)
+            printf(" test");
+        if (project->type == project_type_benchmark)
+            printf(" benchmark");
+        printf("\n");
+        if (project->change != change_sources)
+            continue;
+        for (size_t j = 0; j < changed_source_list->size; j++)
+        {
+            source_descriptor_t *source = (source_descriptor_t*)changed_source_list->data[j];
+            if (source->project == project)
+                printf("    %s\n", source->c_file->data);
+        }
+    }
+    if (affected_count == 0)
+        printf("none\n");
+}
+
+static string_t * create_preprocessed_file_name(string_t *obj_file)
+{
+    string_t base = { obj_file->data, obj_file->length - obj_extension.length };
+    return create_formatted_string("%S.i", base);
+}
+
+/*
+    Sources of all projects are preprocessed in parallel into the target folder,
+    then the preprocessed files are read one by one and removed
+*/
+bool report_header_costs(string_t target, tree_traversal_result_t *sorted_project_list, scheduler_t *scheduler,
+        project_descriptor_t *root_project)
+{
+    printf("\n> Preprocessing sources of target '%s'...\n", target.data);
+    size_t count = sorted_project_list->count;
+    vector_t *object_file_list = create_vector();
+    folder_tree_t *build_folder = create_folder_tree();
+    string_t *target_folder_name = create_target_folder_name(target, &root_project->compiler_options);
+    folder_tree_t *target_folder = create_folder_subtree(build_folder, model_strings, target_folder_name);
+    vector_t *full_build_info = create_vector();
+    for (size_t i = 0; i < count; i++)
+    {
+        project_descriptor_t *project = (project_descriptor_t*)sorted_project_list->list[count - i - 1];
+        if (project->type == project_type_workspace)
+            continue;
+        add_item_to_vector(full_build_info, calculate_project_build_info(project, object_file_list, target_folder));
+    }
+    make_folders(build_folder_name, build_folder);
+    string_t *folder = make_path_2(build_folder_name, *target_folder_name);
+    free(target_folder_name);
+    compiler_t *compiler = get_appropriate_compiler(target, &root_project->compiler_options);
+
+    bool result = true;
+    for (size_t i = 0; i < full_build_info->size; i++)
+    {
+        project_build_info_t *info = (project_build_info_t*)full_build_info->data[i];
+        if (!info->source_list)
+        {
+            result = false;
+            continue;
+        }
+        string_t *h_files = compiler->create_include_files_list(info->header_list);
+        source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
+        while(has_next_source_descriptor(iter))
+        {
+            source_descriptor_t *source = get_next_source_descriptor(iter);
+            string_t *obj_file = make_path_2(*folder, *source->obj_file);
+            string_t *i_file = create_preprocessed_file_name(obj_file);
+            add_action_to_scheduler(scheduler, create_action(
+                compiler->create_cmd_line_preprocess(compiler, source->c_file, h_files, i_file), NULL, NULL));
+            free(i_file);
+            free(obj_file);
+        }
+        destroy_source_list_iterator(iter);
+        free(h_files);
+    }
+    if (!wait_for_actions(scheduler))
+        result = false;
+
+    header_report_t *report = create_header_report();
+    for (size_t i = 0; i < full_build_info->size; i++)
+    {
+        project_build_info_t *info = (project_build_info_t*)full_build_info->data[i];
+        if (!info->source_list)
+            continue;
+        source_list_iterator_t *iter = create_iterator_from_source_list(info->source_list);
+        while(has_next_source_descriptor(iter))
+        {
+            source_descriptor_t *source = get_next_source_descriptor(iter);
+            string_t *obj_file = make_path_2(*folder, *source->obj_file);
+            string_t *i_file = create_preprocessed_file_name(obj_file);
+            if (add_preprocessed_file_to_header_report(report, i_file->data, info->header_list))
+                remove(i_file->data);
+            free(i_file);
+            free(obj_file);
+        }
+        destroy_source_list_iterator(iter);
+    }
+    print_header_report(report);
+    if (!result)
+        fprintf(stderr, "Some sources couldn't be preprocessed, the report is incomplete\n");
+    destroy_header_report(report);
+
+    destroy_compiler(compiler);
+    free(folder);
+    destroy_folder_tree(build_folder);
+    destroy_vector(object_file_list);
+    destroy_vector_and_content(full_build_info, (void*)destroy_project_build_info);
+    return result;
 }
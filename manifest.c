@@ -0,0 +1,500 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the manifest reader
+
+    The file is mapped into memory and parsed in place: keys and strings that contain
+    no escape sequences refer to the mapped bytes, and all values are allocated from
+    an arena that is released together with the mapping.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "manifest.h"
+#include "arena.h"
+#include "files.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct manifest_t
+{
+    arena_t *arena;
+    char *data;
+    size_t size;
+    bool mapped;
+    string_t *content;
+    manifest_value_t *root;
+};
+
+typedef struct
+{
+    arena_t *arena;
+    const char *ptr;
+    const char *end;
+    const char *error;
+} parser_t;
+
+static void skip_spaces(parser_t *parser)
+{
+    while (parser->ptr < parser->end)
+    {
+        char c = *parser->ptr;
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        parser->ptr++;
+    }
+}
+
+static bool expect_char(parser_t *parser, char c)
+{
+    skip_spaces(parser);
+    if (parser->ptr < parser->end && *parser->ptr == c)
+    {
+        parser->ptr++;
+        return true;
+    }
+    return false;
+}
+
+static manifest_value_t * create_value(parser_t *parser, manifest_value_type_t type)
+{
+    manifest_value_t *value = allocate_from_arena(parser->arena, sizeof(manifest_value_t));
+    memset(value, 0, sizeof(manifest_value_t));
+    value->type = type;
+    return value;
+}
+
+static size_t get_utf8_sequence_length(const unsigned char *ptr, const unsigned char *end)
+{
+    unsigned char c = *ptr;
+    size_t length;
+    if (c < 0x80)
+        return 1;
+    else if (c >= 0xC2 && c <= 0xDF)
+        length = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+        length = 3;
+    else if (c >= 0xF0 && c <= 0xF4)
+        length = 4;
+    else
+        return 0;
+    if ((size_t)(end - ptr) < length)
+        return 0;
+    for (size_t i = 1; i < length; i++)
+    {
+        if ((ptr[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return length;
+}
+
+static int parse_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static char * encode_code_point(char *dst, unsigned int code)
+{
+    if (code < 0x80)
+    {
+        *dst++ = (char)code;
+    }
+    else if (code < 0x800)
+    {
+        *dst++ = (char)(0xC0 | (code >> 6));
+        *dst++ = (char)(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        *dst++ = (char)(0xE0 | (code >> 12));
+        *dst++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *dst++ = (char)(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        *dst++ = (char)(0xF0 | (code >> 18));
+        *dst++ = (char)(0x80 | ((code >> 12) & 0x3F));
+        *dst++ = (char)(0x80 | ((code >> 6) & 0x3F));
+        *dst++ = (char)(0x80 | (code & 0x3F));
+    }
+    return dst;
+}
+
+static bool parse_escaped_code_point(parser_t *parser, const char **ptr, unsigned int *code)
+{
+    const char *p = *ptr;
+    if (parser->end - p < 4)
+        return false;
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int digit = parse_hex_digit(p[i]);
+        if (digit < 0)
+            return false;
+        value = (value << 4) | (unsigned int)digit;
+    }
+    *ptr = p + 4;
+    *code = value;
+    return true;
+}
+
+/*
+    The first pass validates the string and finds its end; only a string with escape
+    sequences is decoded into a copy, the worst case is the size of the source
+*/
+static bool parse_string(parser_t *parser, string_t *result)
+{
+    const char *begin = parser->ptr;
+    const char *ptr = begin;
+    bool escaped = false;
+    while (true)
+    {
+        if (ptr >= parser->end)
+        {
+            parser->error = "unterminated string";
+            return false;
+        }
+        unsigned char c = (unsigned char)*ptr;
+        if (c == '"')
+            break;
+        if (c < 0x20)
+        {
+            parser->error = "control character in a string";
+            return false;
+        }
+        if (c == '\\')
+        {
+            escaped = true;
+            ptr += 2;
+            continue;
+        }
+        size_t length = get_utf8_sequence_length((const unsigned char*)ptr, (const unsigned char*)parser->end);
+        if (!length)
+        {
+            parser->error = "the string is not encoded by UTF-8";
+            return false;
+        }
+        ptr += length;
+    }
+    parser->ptr = ptr + 1;
+    if (!escaped)
+    {
+        result->data = (char*)begin;
+        result->length = ptr - begin;
+        return true;
+    }
+
+    const char *src = begin;
+    char *copy = allocate_from_arena(parser->arena, (ptr - begin) + 1);
+    char *dst = copy;
+    while (src < ptr)
+    {
+        if (*src != '\\')
+        {
+            *dst++ = *src++;
+            continue;
+        }
+        src++;
+        switch (*src++)
+        {
+            case '"': *dst++ = '"'; break;
+            case '\\': *dst++ = '\\'; break;
+            case '/': *dst++ = '/'; break;
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'u':
+            {
+                unsigned int code;
+                if (!parse_escaped_code_point(parser, &src, &code))
+                {
+                    parser->error = "invalid escape sequence";
+                    return false;
+                }
+                if (code >= 0xD800 && code <= 0xDBFF)
+                {
+                    unsigned int low;
+                    if (src + 2 > ptr || src[0] != '\\' || src[1] != 'u')
+                    {
+                        parser->error = "invalid surrogate pair";
+                        return false;
+                    }
+                    src += 2;
+                    if (!parse_escaped_code_point(parser, &src, &low) || low < 0xDC00 || low > 0xDFFF)
+                    {
+                        parser->error = "invalid surrogate pair";
+                        return false;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                dst = encode_code_point(dst, code);
+                break;
+            }
+            default:
+                parser->error = "invalid escape sequence";
+                return false;
+        }
+    }
+    *dst = '\0';
+    result->data = copy;
+    result->length = dst - copy;
+    return true;
+}
+
+static bool parse_number(parser_t *parser, double *result)
+{
+    char buffer[64];
+    size_t length = 0;
+    while (parser->ptr < parser->end && length < sizeof(buffer) - 1)
+    {
+        char c = *parser->ptr;
+        if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+            break;
+        buffer[length++] = c;
+        parser->ptr++;
+    }
+    buffer[length] = '\0';
+    char *end;
+    *result = strtod(buffer, &end);
+    if (length == 0 || *end != '\0')
+    {
+        parser->error = "invalid number";
+        return false;
+    }
+    return true;
+}
+
+static bool parse_keyword(parser_t *parser, const char *keyword)
+{
+    size_t length = strlen(keyword);
+    if ((size_t)(parser->end - parser->ptr) < length || memcmp(parser->ptr, keyword, length) != 0)
+    {
+        parser->error = "unexpected character";
+        return false;
+    }
+    parser->ptr += length;
+    return true;
+}
+
+static manifest_value_t * parse_value(parser_t *parser, int depth);
+
+static manifest_value_t * parse_list(parser_t *parser, int depth, bool is_object)
+{
+    manifest_value_t *list = create_value(parser, is_object ? manifest_object : manifest_array);
+    char closing = is_object ? '}' : ']';
+    if (expect_char(parser, closing))
+        return list;
+    manifest_value_t *last = NULL;
+    do
+    {
+        string_t key = { NULL, 0 };
+        if (is_object)
+        {
+            if (!expect_char(parser, '"'))
+            {
+                parser->error = "expected a key";
+                return NULL;
+            }
+            if (!parse_string(parser, &key))
+                return NULL;
+            if (!expect_char(parser, ':'))
+            {
+                parser->error = "expected ':'";
+                return NULL;
+            }
+        }
+        manifest_value_t *item = parse_value(parser, depth + 1);
+        if (!item)
+            return NULL;
+        item->key = key;
+        if (last)
+            last->next = item;
+        else
+            list->data.list.first = item;
+        last = item;
+        list->data.list.count++;
+    } while (expect_char(parser, ','));
+    if (!expect_char(parser, closing))
+    {
+        parser->error = is_object ? "expected ',' or '}'" : "expected ',' or ']'";
+        return NULL;
+    }
+    return list;
+}
+
+static manifest_value_t * parse_value(parser_t *parser, int depth)
+{
+    if (depth > 64)
+    {
+        parser->error = "too deep nesting";
+        return NULL;
+    }
+    skip_spaces(parser);
+    if (parser->ptr >= parser->end)
+    {
+        parser->error = "unexpected end of file";
+        return NULL;
+    }
+    manifest_value_t *value;
+    char c = *parser->ptr;
+    switch (c)
+    {
+        case '{':
+        case '[':
+            parser->ptr++;
+            return parse_list(parser, depth, c == '{');
+        case '"':
+            parser->ptr++;
+            value = create_value(parser, manifest_string);
+            return parse_string(parser, &value->data.string_value) ? value : NULL;
+        case 't':
+        case 'f':
+            value = create_value(parser, manifest_boolean);
+            value->data.boolean_value = c == 't';
+            return parse_keyword(parser, c == 't' ? "true" : "false") ? value : NULL;
+        case 'n':
+            value = create_value(parser, manifest_null);
+            return parse_keyword(parser, "null") ? value : NULL;
+        default:
+            value = create_value(parser, manifest_number);
+            return parse_number(parser, &value->data.number_value) ? value : NULL;
+    }
+}
+
+static size_t get_line_number(const char *begin, const char *ptr)
+{
+    size_t line = 1;
+    for (const char *p = begin; p < ptr; p++)
+    {
+        if (*p == '\n')
+            line++;
+    }
+    return line;
+}
+
+static bool map_manifest(manifest_t *manifest, const char *file_name)
+{
+#ifdef _WIN32
+    string_t *content = read_file_to_string(file_name);
+    if (!content)
+        return false;
+    manifest->content = content;
+    manifest->data = content->data;
+    manifest->size = content->length;
+    return true;
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    manifest->size = (size_t)st.st_size;
+    manifest->mapped = manifest->size > 0;
+    manifest->data = manifest->mapped ?
+        mmap(NULL, manifest->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (manifest->mapped && manifest->data == MAP_FAILED)
+        return false;
+    return true;
+#endif
+}
+
+static void unmap_manifest(manifest_t *manifest)
+{
+#ifdef _WIN32
+    free(manifest->content);
+#else
+    if (manifest->mapped)
+        munmap(manifest->data, manifest->size);
+#endif
+}
+
+manifest_t * load_manifest(const char *file_name, bool silent_mode)
+{
+    manifest_t *manifest = nnalloc(sizeof(manifest_t));
+    memset(manifest, 0, sizeof(manifest_t));
+    if (!map_manifest(manifest, file_name))
+    {
+        if (!silent_mode)
+            fprintf(stderr,
+                "Can't open file '%s'\n", file_name);
+        free(manifest);
+        return NULL;
+    }
+    manifest->arena = create_arena();
+
+    const char *begin = manifest->data;
+    parser_t parser;
+    parser.arena = manifest->arena;
+    parser.ptr = begin;
+    parser.end = begin + manifest->size;
+    parser.error = NULL;
+    if (parser.end - parser.ptr >= 3 && memcmp(parser.ptr, "\xEF\xBB\xBF", 3) == 0)
+        parser.ptr += 3;
+    manifest->root = parse_value(&parser, 0);
+    if (manifest->root)
+    {
+        skip_spaces(&parser);
+        if (parser.ptr < parser.end)
+        {
+            parser.error = "unexpected data after the end of the document";
+            manifest->root = NULL;
+        }
+    }
+    if (!manifest->root)
+    {
+        if (!silent_mode)
+            fprintf(stderr,
+                "The file '%s' can't be parsed, line %d: %s\n",
+                file_name, (int)get_line_number(begin, parser.ptr), parser.error);
+        unload_manifest(manifest);
+        return NULL;
+    }
+    return manifest;
+}
+
+manifest_value_t * get_manifest_root(manifest_t *manifest)
+{
+    return manifest->root;
+}
+
+manifest_value_t * get_manifest_member(const manifest_value_t *object, const char *key)
+{
+    if (object->type != manifest_object)
+        return NULL;
+    size_t length = strlen(key);
+    for (manifest_value_t *member = object->data.list.first; member; member = member->next)
+    {
+        if (member->key.length == length && memcmp(member->key.data, key, length) == 0)
+            return member;
+    }
+    return NULL;
+}
+
+void unload_manifest(manifest_t *manifest)
+{
+    unmap_manifest(manifest);
+    destroy_arena(manifest->arena);
+    free(manifest);
+}
@@ -0,0 +1,50 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the manifest reader: a JSON parser that works on the UTF-8 bytes
+    of a mapped file
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef enum
+{
+    manifest_null,
+    manifest_boolean,
+    manifest_number,
+    manifest_string,
+    manifest_array,
+    manifest_object
+} manifest_value_type_t;
+
+typedef struct manifest_value_t manifest_value_t;
+
+/*
+    Strings without escape sequences point into the file and are not terminated by zero
+*/
+struct manifest_value_t
+{
+    manifest_value_type_t type;
+    string_t key;
+    manifest_value_t *next;
+    union
+    {
+        bool boolean_value;
+        double number_value;
+        string_t string_value;
+        struct
+        {
+            manifest_value_t *first;
+            size_t count;
+        } list;
+    } data;
+};
+
+typedef struct manifest_t manifest_t;
+
+manifest_t * load_manifest(const char *file_name, bool silent_mode);
+manifest_value_t * get_manifest_root(manifest_t *manifest);
+manifest_value_t * get_manifest_member(const manifest_value_t *object, const char *key);
+void unload_manifest(manifest_t *manifest);
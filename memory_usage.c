@@ -0,0 +1,269 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of functions that measure free memory and predict the memory usage of commands
+
+    Free memory is the least of MemAvailable from /proc/meminfo and of the room left
+    under the memory limits of the cgroup of the process and of all its ancestors.
+    The memory pressure is the share of time some tasks were stalled waiting for memory
+    in the last 10 seconds, as reported by PSI.
+
+    The history keeps the peak resident set size of each command identified by a hash,
+    commands that have never been run are expected to use as much as an average one.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "memory_usage.h"
+#include "tree_map.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define DEFAULT_PEAK_MEMORY ((size_t)256 << 20)
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+size_t get_available_memory()
+{
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+        return SIZE_MAX;
+    return (size_t)status.ullAvailPhys;
+}
+
+double get_memory_pressure()
+{
+    return -1;
+}
+
+#else
+
+static bool read_small_file(const char *file_name, char *buff, size_t size)
+{
+    FILE *stream = fopen(file_name, "r");
+    if (!stream)
+        return false;
+    size_t length = fread(buff, 1, size - 1, stream);
+    buff[length] = '\0';
+    fclose(stream);
+    return length > 0;
+}
+
+static size_t get_available_system_memory()
+{
+    char buff[4096];
+    if (!read_small_file("/proc/meminfo", buff, sizeof(buff)))
+        return SIZE_MAX;
+    char *line = strstr(buff, "MemAvailable:");
+    unsigned long long kilobytes;
+    if (!line || sscanf(line + 13, "%llu", &kilobytes) != 1)
+        return SIZE_MAX;
+    return (size_t)(kilobytes << 10);
+}
+
+static string_t * get_cgroup_folder()
+{
+    char buff[4096];
+    if (!read_small_file("/proc/self/cgroup", buff, sizeof(buff)))
+        return NULL;
+    // only the unified hierarchy (cgroup v2) is supported, its line is "0::<path>"
+    char *line = strstr(buff, "0::");
+    if (!line || (line != buff && line[-1] != '\n'))
+        return NULL;
+    line += 3;
+    char *end = strchr(line, '\n');
+    if (end)
+        *end = '\0';
+    return create_formatted_string("/sys/fs/cgroup%s", line);
+}
+
+static bool read_cgroup_value(string_t *folder, const char *file_name, unsigned long long *value)
+{
+    char buff[64];
+    string_t *path = create_formatted_string("%S/%s", *folder, file_name);
+    bool result = read_small_file(path->data, buff, sizeof(buff)) && sscanf(buff, "%llu", value) == 1;
+    free(path);
+    return result;
+}
+
+static size_t get_available_cgroup_memory(string_t *folder)
+{
+    size_t result = SIZE_MAX;
+    while (folder->length > 14)
+    {
+        unsigned long long limit, usage;
+        if (read_cgroup_value(folder, "memory.max", &limit) && read_cgroup_value(folder, "memory.current", &usage))
+        {
+            size_t available = usage < limit ? (size_t)(limit - usage) : 0;
+            if (available < result)
+                result = available;
+        }
+        while (folder->length > 0 && folder->data[folder->length - 1] != '/')
+            folder->length--;
+        if (folder->length > 0)
+            folder->length--;
+        folder->data[folder->length] = '\0';
+    }
+    return result;
+}
+
+size_t get_available_memory()
+{
+    size_t result = get_available_system_memory();
+    string_t *folder = get_cgroup_folder();
+    if (folder)
+    {
+        size_t available = get_available_cgroup_memory(folder);
+        if (available < result)
+            result = available;
+        free(folder);
+    }
+    return result;
+}
+
+double get_memory_pressure()
+{
+    char buff[512];
+    bool found = false;
+    string_t *folder = get_cgroup_folder();
+    if (folder)
+    {
+        string_t *path = create_formatted_string("%S/memory.pressure", *folder);
+        found = read_small_file(path->data, buff, sizeof(buff));
+        free(path);
+        free(folder);
+    }
+    if (!found && !read_small_file("/proc/pressure/memory", buff, sizeof(buff)))
+        return -1;
+    double pressure;
+    if (sscanf(buff, "some avg10=%lf", &pressure) != 1)
+        return -1;
+    return pressure;
+}
+
+#endif
+
+typedef struct
+{
+    uint64_t key;
+    size_t peak_memory;
+} history_entry_t;
+
+struct memory_history_t
+{
+    string_t *file_name;
+    tree_map_t *entries;
+    size_t count;
+    size_t total_memory;
+    bool changed;
+    pthread_mutex_t mutex;
+};
+
+static int compare_history_entries(const history_entry_t *first, const history_entry_t *second)
+{
+    if (first->key == second->key)
+        return 0;
+    return first->key < second->key ? -1 : 1;
+}
+
+static history_entry_t * get_history_entry(memory_history_t *history, uint64_t key)
+{
+    history_entry_t sample = { key, 0 };
+    const pair_t *pair = get_pair_from_tree_map(history->entries, &sample);
+    return pair ? (history_entry_t*)pair->value : NULL;
+}
+
+static void set_history_entry(memory_history_t *history, uint64_t key, size_t peak_memory)
+{
+    history_entry_t *entry = get_history_entry(history, key);
+    if (entry)
+    {
+        history->total_memory -= entry->peak_memory;
+    }
+    else
+    {
+        entry = nnalloc(sizeof(history_entry_t));
+        entry->key = key;
+        add_pair_to_tree_map(history->entries, entry, entry);
+        history->count++;
+    }
+    entry->peak_memory = peak_memory;
+    history->total_memory += peak_memory;
+}
+
+memory_history_t * load_memory_history(string_t *file_name)
+{
+    memory_history_t *history = nnalloc(sizeof(memory_history_t));
+    history->file_name = duplicate_string(*file_name);
+    history->entries = create_tree_map((void*)compare_history_entries);
+    history->count = 0;
+    history->total_memory = 0;
+    history->changed = false;
+    pthread_mutex_init(&history->mutex, NULL);
+    FILE *stream = fopen(file_name->data, "r");
+    if (stream)
+    {
+        unsigned long long key, peak_memory;
+        while (fscanf(stream, "%llx %llu", &key, &peak_memory) == 2)
+            set_history_entry(history, (uint64_t)key, (size_t)peak_memory);
+        fclose(stream);
+    }
+    return history;
+}
+
+size_t predict_peak_memory(memory_history_t *history, uint64_t key)
+{
+    pthread_mutex_lock(&history->mutex);
+    history_entry_t *entry = get_history_entry(history, key);
+    size_t result;
+    if (entry)
+        result = entry->peak_memory;
+    else if (history->count)
+        result = history->total_memory / history->count;
+    else
+        result = DEFAULT_PEAK_MEMORY;
+    pthread_mutex_unlock(&history->mutex);
+    return result;
+}
+
+void record_peak_memory(memory_history_t *history, uint64_t key, size_t peak_memory)
+{
+    pthread_mutex_lock(&history->mutex);
+    set_history_entry(history, key, peak_memory);
+    history->changed = true;
+    pthread_mutex_unlock(&history->mutex);
+}
+
+void save_memory_history(memory_history_t *history)
+{
+    pthread_mutex_lock(&history->mutex);
+    FILE *stream = history->changed ? fopen(history->file_name->data, "w") : NULL;
+    if (stream)
+    {
+        map_iterator_t *iter = create_iterator_from_tree_map(history->entries);
+        while (has_next_pair(iter))
+        {
+            history_entry_t *entry = (history_entry_t*)next_pair(iter)->value;
+            fprintf(stream, "%016llx %llu\n", (unsigned long long)entry->key, (unsigned long long)entry->peak_memory);
+        }
+        destroy_map_iterator(iter);
+        fclose(stream);
+        history->changed = false;
+    }
+    pthread_mutex_unlock(&history->mutex);
+}
+
+void destroy_memory_history(memory_history_t *history)
+{
+    destroy_tree_map_and_content(history->entries, free, NULL);
+    pthread_mutex_destroy(&history->mutex);
+    free(history->file_name);
+    free(history);
+}
@@ -0,0 +1,21 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of functions that measure free memory and predict the memory usage of commands
+*/
+
+#pragma once
+
+#include "strings.h"
+
+#include <stdint.h>
+
+typedef struct memory_history_t memory_history_t;
+
+size_t get_available_memory();
+double get_memory_pressure();
+memory_history_t * load_memory_history(string_t *file_name);
+size_t predict_peak_memory(memory_history_t *history, uint64_t key);
+void record_peak_memory(memory_history_t *history, uint64_t key, size_t peak_memory);
+void save_memory_history(memory_history_t *history);
+void destroy_memory_history(memory_history_t *history);
@@ -0,0 +1,224 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the command line parser
+
+    Without options, all projects are built for the 'debug' and 'release' targets;
+    the 'fastdebug' target, built by the fastest compiler found, and the 'native' target,
+    tuned for the host CPU, are built only on demand.
+    A target may be given several times; each target is built once, in the given order.
+    With a list of changed files, the projects affected by them are printed, and built
+    if asked to. Reports are made for the first target instead of building.
+*/
+
+#include "options.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *known_targets[] =
+{
+    "debug",
+    "release",
+    "fastdebug",
+    "native",
+    NULL
+};
+
+/*
+    The number of targets, from the beginning of the list, that are built by default
+*/
+static const size_t default_targets_count = 2;
+
+static const char *report_names[] =
+{
+    NULL,
+    "headers",
+    "history"
+};
+
+static bool is_option(const char *arg, const char *short_name, const char *long_name)
+{
+    return 0 == strcmp(arg, short_name) || 0 == strcmp(arg, long_name);
+}
+
+static bool is_known_target(const char *name)
+{
+    for (size_t i = 0; known_targets[i]; i++)
+    {
+        if (0 == strcmp(name, known_targets[i]))
+            return true;
+    }
+    return false;
+}
+
+static bool add_target(options_t *options, const char *name)
+{
+    if (!is_known_target(name))
+    {
+        fprintf(stderr, "Unknown target '%s'\n", name);
+        return false;
+    }
+    string_t target = _S(name);
+    for (size_t i = 0; i < options->targets->size; i++)
+    {
+        if (are_strings_equal(target, *((string_t*)options->targets->data[i])))
+            return true;
+    }
+    add_item_to_vector(options->targets, duplicate_string(target));
+    return true;
+}
+
+static bool set_report(options_t *options, const char *name)
+{
+    for (size_t i = report_headers; i < sizeof(report_names) / sizeof(report_names[0]); i++)
+    {
+        if (0 == strcmp(name, report_names[i]))
+        {
+            options->report = (report_kind_t)i;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown report '%s'\n", name);
+    return false;
+}
+
+static bool parse_positive_number(const char *arg, const char *name, double *value)
+{
+    char *end;
+    *value = strtod(arg, &end);
+    if (end == arg || *end != '\0' || *value <= 0)
+    {
+        fprintf(stderr, "The option '%s' requires a positive number\n", name);
+        return false;
+    }
+    return true;
+}
+
+void print_usage()
+{
+    printf(
+        "Usage: factory [options]\n"
+        "  -t, --target <name>      build the target ('debug', 'release', 'fastdebug' or 'native'),\n"
+        "                           may be repeated; 'debug' and 'release' are built by default\n"
+        "  -p, --project <name>     build only the project and the projects it depends on\n"
+        "  -c, --changed <file>     print projects and sources affected by the files listed\n"
+        "                           in the file ('-' reads the list from the standard input)\n"
+        "  -b, --build              with '--changed', build, and test only the affected set\n"
+        "  -r, --report <name>      print a report instead of building, for the first target:\n"
+        "                           'headers' ranks headers by the preprocessing work they cause,\n"
+        "                           'history' lists sources that got slower or bigger since\n"
+        "                           the previous build\n"
+        "  --since <days>           with '--report history', compare with the last build\n"
+        "                           made before the given number of days\n"
+        "  --max-compile-time <s>   with '--report history', fail if the total compile time\n"
+        "                           of all sources exceeds the given number of seconds\n"
+        "  -h, --help               print this message\n"
+        "       factory --worker <address>\n"
+        "       factory --cache-server <port> <folder>\n");
+}
+
+options_t * parse_options(int argc, char **argv)
+{
+    options_t *options = nnalloc(sizeof(options_t));
+    memset(options, 0, sizeof(options_t));
+    options->mode = mode_build;
+    options->targets = create_vector();
+
+    if (argc == 3 && 0 == strcmp(argv[1], "--worker"))
+    {
+        options->mode = mode_worker;
+        options->worker_address = argv[2];
+        return options;
+    }
+    if (argc == 4 && 0 == strcmp(argv[1], "--cache-server"))
+    {
+        options->mode = mode_cache_server;
+        options->cache_server_port = argv[2];
+        options->cache_server_folder = argv[3];
+        return options;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (is_option(arg, "-h", "--help"))
+        {
+            options->mode = mode_help;
+            return options;
+        }
+        bool has_value = i + 1 < argc;
+        if (is_option(arg, "-t", "--target") && has_value)
+        {
+            if (!add_target(options, argv[++i]))
+                goto error;
+        }
+        else if (is_option(arg, "-p", "--project") && has_value)
+        {
+            options->project = argv[++i];
+        }
+        else if (is_option(arg, "-c", "--changed") && has_value)
+        {
+            options->changed_files = argv[++i];
+        }
+        else if (is_option(arg, "-r", "--report") && has_value)
+        {
+            if (!set_report(options, argv[++i]))
+                goto error;
+        }
+        else if (0 == strcmp(arg, "--since") && has_value)
+        {
+            if (!parse_positive_number(argv[++i], arg, &options->history_window))
+                goto error;
+        }
+        else if (0 == strcmp(arg, "--max-compile-time") && has_value)
+        {
+            if (!parse_positive_number(argv[++i], arg, &options->compile_time_limit))
+                goto error;
+        }
+        else if (is_option(arg, "-b", "--build"))
+        {
+            options->build_affected = true;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid argument '%s'\n", arg);
+            goto error;
+        }
+    }
+
+    if (options->build_affected && !options->changed_files)
+    {
+        fprintf(stderr, "The option '--build' requires the list of changed files\n");
+        goto error;
+    }
+    if (options->report != report_none && options->changed_files)
+    {
+        fprintf(stderr, "The option '--report' can't be combined with '--changed'\n");
+        goto error;
+    }
+    if ((options->history_window > 0 || options->compile_time_limit > 0) && options->report != report_history)
+    {
+        fprintf(stderr, "The options '--since' and '--max-compile-time' require '--report history'\n");
+        goto error;
+    }
+    if (options->targets->size == 0)
+    {
+        for (size_t i = 0; i < default_targets_count; i++)
+            add_target(options, known_targets[i]);
+    }
+    return options;
+
+error:
+    print_usage();
+    destroy_options(options);
+    return NULL;
+}
+
+void destroy_options(options_t *options)
+{
+    destroy_vector_and_content(options->targets, free);
+    free(options);
+}
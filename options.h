@@ -0,0 +1,44 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the command line options
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+typedef enum
+{
+    mode_build,
+    mode_worker,
+    mode_cache_server,
+    mode_help
+} run_mode_t;
+
+typedef enum
+{
+    report_none,
+    report_headers,
+    report_history
+} report_kind_t;
+
+typedef struct
+{
+    run_mode_t mode;
+    vector_t *targets;
+    const char *project;
+    const char *changed_files;
+    bool build_affected;
+    report_kind_t report;
+    double history_window;
+    double compile_time_limit;
+    const char *worker_address;
+    const char *cache_server_port;
+    const char *cache_server_folder;
+} options_t;
+
+options_t * parse_options(int argc, char **argv);
+void print_usage();
+void destroy_options(options_t *options);
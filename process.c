@@ -0,0 +1,172 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of functions that start external processes
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "process.h"
+#include "strings.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+int execute_command(const char *cmd, const char *working_folder, const char *output_file)
+{
+    return execute_command_and_measure(cmd, working_folder, output_file, 0, NULL, NULL);
+}
+
+int execute_command_with_timeout(const char *cmd, const char *working_folder, const char *output_file,
+        double timeout, bool *timed_out)
+{
+    return execute_command_and_measure(cmd, working_folder, output_file, timeout, timed_out, NULL);
+}
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+int execute_command_and_measure(const char *cmd, const char *working_folder, const char *output_file,
+        double timeout, bool *timed_out, size_t *peak_memory)
+{
+    if (peak_memory)
+        *peak_memory = 0;
+    string_builder_t *full_cmd = NULL;
+    if (working_folder)
+        full_cmd = append_formatted_string(full_cmd, "cd /d %s && ", working_folder);
+    full_cmd = append_formatted_string(full_cmd, "%s", cmd);
+    if (output_file)
+        full_cmd = append_formatted_string(full_cmd, " > %s 2>&1", output_file);
+    int result = system(((string_t*)full_cmd)->data);
+    free(full_cmd);
+    if (timed_out)
+        *timed_out = false;
+    return result;
+}
+
+double get_current_time()
+{
+    return (double)GetTickCount64() / 1000.0;
+}
+
+size_t get_number_of_processors()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static pid_t start_process(const char *cmd, const char *working_folder, const char *output_file, bool new_group)
+{
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    if (new_group)
+        setpgid(0, 0);
+    if (working_folder && chdir(working_folder) != 0)
+        _exit(127);
+    if (output_file)
+    {
+        int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            _exit(127);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    _exit(127);
+}
+
+static int get_exit_code(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return -1;
+}
+
+/*
+    The usage returned by wait4 includes descendants the process has waited for,
+    so the peak of a compiler driver covers the compiler proper as well
+*/
+static void store_peak_memory(struct rusage *usage, size_t *peak_memory)
+{
+    if (peak_memory)
+        *peak_memory = (size_t)usage->ru_maxrss << 10;
+}
+
+int execute_command_and_measure(const char *cmd, const char *working_folder, const char *output_file,
+        double timeout, bool *timed_out, size_t *peak_memory)
+{
+    if (timed_out)
+        *timed_out = false;
+    if (peak_memory)
+        *peak_memory = 0;
+    pid_t pid = start_process(cmd, working_folder, output_file, timeout > 0);
+    if (pid < 0)
+        return -1;
+    int status;
+    struct rusage usage;
+    if (timeout <= 0)
+    {
+        while (wait4(pid, &status, 0, &usage) < 0)
+        {
+            if (errno != EINTR)
+                return -1;
+        }
+        store_peak_memory(&usage, peak_memory);
+        return get_exit_code(status);
+    }
+
+    // the process runs in its own group, so the whole tree is killed on timeout
+    double deadline = get_current_time() + timeout;
+    struct timespec pause = { 0, 10000000 };
+    while (true)
+    {
+        pid_t result = wait4(pid, &status, WNOHANG, &usage);
+        if (result == pid)
+        {
+            store_peak_memory(&usage, peak_memory);
+            return get_exit_code(status);
+        }
+        if (result < 0 && errno != EINTR)
+            return -1;
+        if (get_current_time() > deadline)
+        {
+            kill(-pid, SIGKILL);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            if (timed_out)
+                *timed_out = true;
+            return -1;
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
+double get_current_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+size_t get_number_of_processors()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+
+#endif
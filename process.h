@@ -0,0 +1,18 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of functions that start external processes
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+int execute_command(const char *cmd, const char *working_folder, const char *output_file);
+int execute_command_with_timeout(const char *cmd, const char *working_folder, const char *output_file,
+        double timeout, bool *timed_out);
+int execute_command_and_measure(const char *cmd, const char *working_folder, const char *output_file,
+        double timeout, bool *timed_out, size_t *peak_memory);
+double get_current_time();
+size_t get_number_of_processors();
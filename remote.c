@@ -0,0 +1,762 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the remote execution protocol
+
+    Integers are sent in network byte order, strings are sent as a 32-bit length
+    followed by bytes. A session looks like this:
+
+    worker -> client  'FWRK', number of slots
+    client -> worker  'ACTN', command, inputs (path, size, hash), outputs (path)
+    worker -> client  status; if accepted, indexes of inputs missing in the worker's store
+    client -> worker  contents of the missing inputs
+    worker -> client  exit code, log, outputs (presence flag, size, contents)
+
+    The worker keeps received files in a content-addressed store next to its socket,
+    so headers shared by many actions are transferred only once.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "remote.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+
+remote_worker_t * connect_to_remote_worker(const char *address)
+{
+    return NULL;
+}
+
+size_t get_number_of_remote_worker_slots(remote_worker_t *worker)
+{
+    return 0;
+}
+
+remote_status_t execute_action_remotely(remote_worker_t *worker, string_t *cmd,
+    vector_t *inputs, vector_t *outputs, int *exit_code)
+{
+    return remote_connection_lost;
+}
+
+void disconnect_remote_worker(remote_worker_t *worker)
+{
+}
+
+void destroy_remote_file_digests()
+{
+}
+
+int run_remote_worker(const char *address)
+{
+    fprintf(stderr, "Remote workers are not supported on this platform\n");
+    return -1;
+}
+
+#else
+
+#include "hash.h"
+#include "process.h"
+#include "files.h"
+#include "folders.h"
+#include "tree_map.h"
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const uint32_t handshake_magic = 0x46574B52;
+static const uint32_t action_magic = 0x4143544E;
+static const uint32_t action_accepted = 0;
+static const uint32_t action_rejected = 1;
+static const uint32_t max_path_length = 4096;
+static const uint32_t max_command_length = 1 << 20;
+static const uint32_t max_log_length = 1 << 26;
+static const uint32_t max_number_of_files = 1 << 20;
+
+struct remote_worker_t
+{
+    int socket;
+    size_t slots;
+};
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} message_t;
+
+typedef struct
+{
+    uint64_t size;
+    uint64_t hash;
+} file_digest_t;
+
+static pthread_mutex_t digest_mutex = PTHREAD_MUTEX_INITIALIZER;
+static tree_map_t *digest_cache = NULL;
+
+static void put_bytes(message_t *msg, const void *data, size_t size)
+{
+    if (msg->size + size > msg->capacity)
+    {
+        size_t capacity = msg->capacity ? msg->capacity * 2 : 256;
+        while (capacity < msg->size + size)
+            capacity *= 2;
+        char *new_data = nnalloc(capacity);
+        if (msg->size)
+            memcpy(new_data, msg->data, msg->size);
+        free(msg->data);
+        msg->data = new_data;
+        msg->capacity = capacity;
+    }
+    memcpy(msg->data + msg->size, data, size);
+    msg->size += size;
+}
+
+static void put_u32(message_t *msg, uint32_t value)
+{
+    unsigned char bytes[4] =
+    {
+        (unsigned char)(value >> 24), (unsigned char)(value >> 16),
+        (unsigned char)(value >> 8), (unsigned char)value
+    };
+    put_bytes(msg, bytes, 4);
+}
+
+static void put_u64(message_t *msg, uint64_t value)
+{
+    put_u32(msg, (uint32_t)(value >> 32));
+    put_u32(msg, (uint32_t)value);
+}
+
+static void put_string(message_t *msg, const char *data, size_t length)
+{
+    put_u32(msg, (uint32_t)length);
+    put_bytes(msg, data, length);
+}
+
+static bool send_all(int fd, const void *data, size_t size)
+{
+    const char *ptr = (const char*)data;
+    while (size > 0)
+    {
+        ssize_t sent = write(fd, ptr, size);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool send_message(int fd, message_t *msg)
+{
+    bool result = send_all(fd, msg->data, msg->size);
+    msg->size = 0;
+    return result;
+}
+
+static bool receive_all(int fd, void *data, size_t size)
+{
+    char *ptr = (char*)data;
+    while (size > 0)
+    {
+        ssize_t received = read(fd, ptr, size);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (received == 0)
+            return false;
+        ptr += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+static bool receive_u32(int fd, uint32_t *value)
+{
+    unsigned char bytes[4];
+    if (!receive_all(fd, bytes, 4))
+        return false;
+    *value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    return true;
+}
+
+static bool receive_u64(int fd, uint64_t *value)
+{
+    uint32_t high, low;
+    if (!receive_u32(fd, &high) || !receive_u32(fd, &low))
+        return false;
+    *value = ((uint64_t)high << 32) | low;
+    return true;
+}
+
+static char * receive_string(int fd, uint32_t max_length, size_t *length)
+{
+    uint32_t size;
+    if (!receive_u32(fd, &size) || size > max_length)
+        return NULL;
+    char *data = nnalloc(size + 1);
+    if (!receive_all(fd, data, size))
+    {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    if (length)
+        *length = size;
+    return data;
+}
+
+static bool send_file(int fd, const char *path, uint64_t size)
+{
+    char buff[65536];
+    FILE *stream = fopen(path, "rb");
+    bool result = true;
+    while (size > 0 && result)
+    {
+        size_t portion = size < sizeof(buff) ? (size_t)size : sizeof(buff);
+        size_t read_bytes = stream ? fread(buff, 1, portion, stream) : 0;
+        if (read_bytes < portion)
+            memset(buff + read_bytes, 0, portion - read_bytes);
+        result = send_all(fd, buff, portion);
+        size -= portion;
+    }
+    if (stream)
+        fclose(stream);
+    return result;
+}
+
+static bool receive_to_file(int fd, const char *path, uint64_t size, uint64_t *hash)
+{
+    char buff[65536];
+    FILE *stream = fopen(path, "wb");
+    bool result = true;
+    uint64_t actual_hash = initial_hash_value;
+    while (size > 0)
+    {
+        size_t portion = size < sizeof(buff) ? (size_t)size : sizeof(buff);
+        if (!receive_all(fd, buff, portion))
+        {
+            if (stream)
+                fclose(stream);
+            return false;
+        }
+        actual_hash = calculate_hash(actual_hash, buff, portion);
+        if (stream && fwrite(buff, 1, portion, stream) != portion)
+            result = false;
+        size -= portion;
+    }
+    if (!stream || fclose(stream) != 0)
+        result = false;
+    if (hash)
+        *hash = actual_hash;
+    return result;
+}
+
+static bool is_relative_path_inside_folder(const char *path)
+{
+    if (path[0] == '\0' || path[0] == '/')
+        return false;
+    const char *segment = path;
+    while (true)
+    {
+        const char *end = strchr(segment, '/');
+        size_t length = end ? (size_t)(end - segment) : strlen(segment);
+        if (length == 2 && segment[0] == '.' && segment[1] == '.')
+            return false;
+        if (!end)
+            return true;
+        segment = end + 1;
+    }
+}
+
+static bool get_file_digest(string_t *path, file_digest_t *digest)
+{
+    pthread_mutex_lock(&digest_mutex);
+    if (!digest_cache)
+        digest_cache = create_tree_map((void*)compare_strings);
+    const pair_t *pair = get_pair_from_tree_map(digest_cache, path);
+    if (pair)
+        *digest = *((file_digest_t*)pair->value);
+    pthread_mutex_unlock(&digest_mutex);
+    if (pair)
+        return true;
+
+    string_t *content = read_file_to_string(path->data);
+    if (!content)
+        return false;
+    digest->size = content->length;
+    digest->hash = calculate_hash(initial_hash_value, content->data, content->length);
+    free(content);
+
+    pthread_mutex_lock(&digest_mutex);
+    if (!get_pair_from_tree_map(digest_cache, path))
+    {
+        file_digest_t *record = nnalloc(sizeof(file_digest_t));
+        *record = *digest;
+        add_pair_to_tree_map(digest_cache, duplicate_string(*path), record);
+    }
+    pthread_mutex_unlock(&digest_mutex);
+    return true;
+}
+
+void destroy_remote_file_digests()
+{
+    pthread_mutex_lock(&digest_mutex);
+    if (digest_cache)
+        destroy_tree_map_and_content(digest_cache, free, free);
+    digest_cache = NULL;
+    pthread_mutex_unlock(&digest_mutex);
+}
+
+remote_worker_t * connect_to_remote_worker(const char *address)
+{
+    struct sockaddr_un addr;
+    if (strlen(address) >= sizeof(addr.sun_path))
+        return NULL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, address);
+
+    signal(SIGPIPE, SIG_IGN);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return NULL;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    uint32_t magic, slots;
+    if (!receive_u32(fd, &magic) || magic != handshake_magic || !receive_u32(fd, &slots) || slots == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    remote_worker_t *worker = nnalloc(sizeof(remote_worker_t));
+    worker->socket = fd;
+    worker->slots = slots;
+    return worker;
+}
+
+size_t get_number_of_remote_worker_slots(remote_worker_t *worker)
+{
+    return worker->slots;
+}
+
+remote_status_t execute_action_remotely(remote_worker_t *worker, string_t *cmd,
+    vector_t *inputs, vector_t *outputs, int *exit_code)
+{
+    size_t input_count = inputs->size;
+    size_t output_count = outputs->size;
+    for (size_t i = 0; i < output_count; i++)
+    {
+        if (!is_relative_path_inside_folder(((string_t*)outputs->data[i])->data))
+            return remote_action_rejected;
+    }
+    file_digest_t *digests = nnalloc(sizeof(file_digest_t) * (input_count + 1));
+    for (size_t i = 0; i < input_count; i++)
+    {
+        string_t *path = (string_t*)inputs->data[i];
+        if (!is_relative_path_inside_folder(path->data) || !get_file_digest(path, &digests[i]))
+        {
+            free(digests);
+            return remote_action_rejected;
+        }
+    }
+
+    remote_status_t status = remote_connection_lost;
+    uint32_t *missing = NULL;
+    char *log = NULL;
+    message_t msg = { NULL, 0, 0 };
+    put_u32(&msg, action_magic);
+    put_string(&msg, cmd->data, cmd->length);
+    put_u32(&msg, (uint32_t)input_count);
+    for (size_t i = 0; i < input_count; i++)
+    {
+        string_t *path = (string_t*)inputs->data[i];
+        put_string(&msg, path->data, path->length);
+        put_u64(&msg, digests[i].size);
+        put_u64(&msg, digests[i].hash);
+    }
+    put_u32(&msg, (uint32_t)output_count);
+    for (size_t i = 0; i < output_count; i++)
+    {
+        string_t *path = (string_t*)outputs->data[i];
+        put_string(&msg, path->data, path->length);
+    }
+    if (!send_message(worker->socket, &msg))
+        goto cleanup;
+
+    uint32_t accepted, missing_count;
+    if (!receive_u32(worker->socket, &accepted))
+        goto cleanup;
+    if (accepted != action_accepted)
+    {
+        status = remote_action_rejected;
+        goto cleanup;
+    }
+    if (!receive_u32(worker->socket, &missing_count) || missing_count > input_count)
+        goto cleanup;
+    missing = nnalloc(sizeof(uint32_t) * (missing_count + 1));
+    for (uint32_t i = 0; i < missing_count; i++)
+    {
+        if (!receive_u32(worker->socket, &missing[i]) || missing[i] >= input_count)
+            goto cleanup;
+    }
+    for (uint32_t i = 0; i < missing_count; i++)
+    {
+        string_t *path = (string_t*)inputs->data[missing[i]];
+        if (!send_file(worker->socket, path->data, digests[missing[i]].size))
+            goto cleanup;
+    }
+
+    uint32_t code, returned_count;
+    size_t log_length;
+    if (!receive_u32(worker->socket, &code))
+        goto cleanup;
+    log = receive_string(worker->socket, max_log_length, &log_length);
+    if (!log)
+        goto cleanup;
+    fwrite(log, 1, log_length, stdout);
+    if (!receive_u32(worker->socket, &returned_count) || returned_count != output_count)
+        goto cleanup;
+    bool outputs_saved = true;
+    for (size_t i = 0; i < output_count; i++)
+    {
+        uint32_t present;
+        uint64_t size;
+        if (!receive_u32(worker->socket, &present) || !receive_u64(worker->socket, &size))
+            goto cleanup;
+        if (present && !receive_to_file(worker->socket, ((string_t*)outputs->data[i])->data, size, NULL))
+            outputs_saved = false;
+    }
+    *exit_code = outputs_saved ? (int)(int32_t)code : -1;
+    status = remote_action_executed;
+
+cleanup:
+    free(log);
+    free(missing);
+    free(msg.data);
+    free(digests);
+    return status;
+}
+
+void disconnect_remote_worker(remote_worker_t *worker)
+{
+    close(worker->socket);
+    free(worker);
+}
+
+static void make_parent_folders(char *path)
+{
+    for (char *ptr = path + 1; *ptr; ptr++)
+    {
+        if (*ptr == '/')
+        {
+            *ptr = '\0';
+            mkdir(path, 0755);
+            *ptr = '/';
+        }
+    }
+}
+
+static bool copy_file(const char *source, const char *destination)
+{
+    char buff[65536];
+    FILE *input = fopen(source, "rb");
+    if (!input)
+        return false;
+    FILE *output = fopen(destination, "wb");
+    if (!output)
+    {
+        fclose(input);
+        return false;
+    }
+    bool result = true;
+    size_t size;
+    while ((size = fread(buff, 1, sizeof(buff), input)) > 0 && result)
+        result = fwrite(buff, 1, size, output) == size;
+    fclose(input);
+    return fclose(output) == 0 && result;
+}
+
+static void remove_folder_recursively(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir)
+    {
+        struct dirent *dent;
+        while ((dent = readdir(dir)) != NULL)
+        {
+            if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+                continue;
+            string_t *child = create_formatted_string("%s/%s", path, dent->d_name);
+            struct stat info;
+            if (lstat(child->data, &info) == 0 && S_ISDIR(info.st_mode))
+                remove_folder_recursively(child->data);
+            else
+                unlink(child->data);
+            free(child);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+static string_t * get_blob_path(string_t *store, uint64_t hash)
+{
+    return create_formatted_string("%S/%08x%08x", *store, (unsigned int)(hash >> 32), (unsigned int)hash);
+}
+
+static bool serve_action(int connection, string_t *store, message_t *msg)
+{
+    bool alive = false;
+    uint32_t input_count = 0, output_count = 0;
+    char **input_paths = NULL;
+    file_digest_t *digests = NULL;
+    char **output_paths = NULL;
+    string_t *sandbox = NULL;
+    string_t *log_path = NULL;
+
+    char *cmd = receive_string(connection, max_command_length, NULL);
+    if (!cmd || !receive_u32(connection, &input_count) || input_count > max_number_of_files)
+        goto cleanup;
+    input_paths = nnalloc(sizeof(char*) * (input_count + 1));
+    memset(input_paths, 0, sizeof(char*) * (input_count + 1));
+    digests = nnalloc(sizeof(file_digest_t) * (input_count + 1));
+    bool valid = true;
+    for (uint32_t i = 0; i < input_count; i++)
+    {
+        input_paths[i] = receive_string(connection, max_path_length, NULL);
+        if (!input_paths[i] || !receive_u64(connection, &digests[i].size) || !receive_u64(connection, &digests[i].hash))
+            goto cleanup;
+        valid = valid && is_relative_path_inside_folder(input_paths[i]);
+    }
+    if (!receive_u32(connection, &output_count) || output_count > max_number_of_files)
+    {
+        output_count = 0;
+        goto cleanup;
+    }
+    output_paths = nnalloc(sizeof(char*) * (output_count + 1));
+    memset(output_paths, 0, sizeof(char*) * (output_count + 1));
+    for (uint32_t i = 0; i < output_count; i++)
+    {
+        output_paths[i] = receive_string(connection, max_path_length, NULL);
+        if (!output_paths[i])
+            goto cleanup;
+        valid = valid && is_relative_path_inside_folder(output_paths[i]);
+    }
+    if (!valid)
+    {
+        put_u32(msg, action_rejected);
+        alive = send_message(connection, msg);
+        goto cleanup;
+    }
+
+    // request contents that are not in the store yet
+    bool *missing = nnalloc(sizeof(bool) * (input_count + 1));
+    uint32_t missing_count = 0;
+    for (uint32_t i = 0; i < input_count; i++)
+    {
+        string_t *blob = get_blob_path(store, digests[i].hash);
+        missing[i] = !file_exists(blob->data);
+        if (missing[i])
+            missing_count++;
+        free(blob);
+    }
+    put_u32(msg, action_accepted);
+    put_u32(msg, missing_count);
+    for (uint32_t i = 0; i < input_count; i++)
+    {
+        if (missing[i])
+            put_u32(msg, i);
+    }
+    bool received = send_message(connection, msg);
+    for (uint32_t i = 0; i < input_count && received; i++)
+    {
+        if (!missing[i])
+            continue;
+        string_t *tmp = create_formatted_string("%S/tmp-%d-%u", *store, (int)getpid(), i);
+        uint64_t actual_hash;
+        received = receive_to_file(connection, tmp->data, digests[i].size, &actual_hash);
+        if (received)
+        {
+            digests[i].hash = actual_hash;
+            string_t *blob = get_blob_path(store, actual_hash);
+            rename(tmp->data, blob->data);
+            free(blob);
+        }
+        free(tmp);
+    }
+    free(missing);
+    if (!received)
+        goto cleanup;
+
+    // prepare a sandbox that mirrors the client's folder layout
+    char sandbox_template[] = "/tmp/factory-action-XXXXXX";
+    if (!mkdtemp(sandbox_template))
+        goto cleanup;
+    sandbox = duplicate_string(_S(sandbox_template));
+    log_path = create_formatted_string("%S.log", *sandbox);
+    for (uint32_t i = 0; i < input_count; i++)
+    {
+        string_t *blob = get_blob_path(store, digests[i].hash);
+        string_t *destination = create_formatted_string("%S/%s", *sandbox, input_paths[i]);
+        make_parent_folders(destination->data);
+        if (link(blob->data, destination->data) != 0)
+            copy_file(blob->data, destination->data);
+        free(destination);
+        free(blob);
+    }
+    for (uint32_t i = 0; i < output_count; i++)
+    {
+        string_t *destination = create_formatted_string("%S/%s", *sandbox, output_paths[i]);
+        make_parent_folders(destination->data);
+        free(destination);
+    }
+
+    int code = execute_command(cmd, sandbox->data, log_path->data);
+
+    string_t *log = read_file_to_string(log_path->data);
+    put_u32(msg, (uint32_t)(int32_t)code);
+    if (log && log->length <= max_log_length)
+        put_string(msg, log->data, log->length);
+    else
+        put_string(msg, "", 0);
+    free(log);
+    put_u32(msg, output_count);
+    if (!send_message(connection, msg))
+        goto cleanup;
+    for (uint32_t i = 0; i < output_count; i++)
+    {
+        string_t *result_file = create_formatted_string("%S/%s", *sandbox, output_paths[i]);
+        struct stat info;
+        bool present = stat(result_file->data, &info) == 0 && S_ISREG(info.st_mode);
+        put_u32(msg, present ? 1 : 0);
+        put_u64(msg, present ? (uint64_t)info.st_size : 0);
+        bool sent = send_message(connection, msg) && (!present || send_file(connection, result_file->data, (uint64_t)info.st_size));
+        free(result_file);
+        if (!sent)
+            goto cleanup;
+    }
+    alive = true;
+
+cleanup:
+    if (sandbox)
+        remove_folder_recursively(sandbox->data);
+    if (log_path)
+        unlink(log_path->data);
+    free(sandbox);
+    free(log_path);
+    if (output_paths)
+    {
+        for (uint32_t i = 0; i < output_count; i++)
+            free(output_paths[i]);
+        free(output_paths);
+    }
+    if (input_paths)
+    {
+        for (uint32_t i = 0; i < input_count; i++)
+            free(input_paths[i]);
+        free(input_paths);
+    }
+    free(digests);
+    free(cmd);
+    return alive;
+}
+
+static void serve_connection(int connection, string_t *store)
+{
+    message_t msg = { NULL, 0, 0 };
+    put_u32(&msg, handshake_magic);
+    put_u32(&msg, (uint32_t)get_number_of_processors());
+    bool alive = send_message(connection, &msg);
+    uint32_t magic;
+    while (alive && receive_u32(connection, &magic) && magic == action_magic)
+        alive = serve_action(connection, store, &msg);
+    free(msg.data);
+    close(connection);
+}
+
+int run_remote_worker(const char *address)
+{
+    struct sockaddr_un addr;
+    if (strlen(address) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "The socket path '%s' is too long\n", address);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, address);
+
+    string_t *store = create_formatted_string("%s.store", address);
+    if (!folder_exists(store->data) && !make_folder(store->data))
+    {
+        fprintf(stderr, "Couldn't create folder '%s'\n", store->data);
+        free(store);
+        return -1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(address);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0)
+    {
+        fprintf(stderr, "Couldn't listen on '%s'\n", address);
+        if (listener >= 0)
+            close(listener);
+        free(store);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+    printf("> Worker is listening on '%s'...\n", address);
+    fflush(stdout);
+    while (true)
+    {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listener);
+            signal(SIGCHLD, SIG_DFL);
+            serve_connection(connection, store);
+            _exit(0);
+        }
+        close(connection);
+    }
+    close(listener);
+    free(store);
+    return -1;
+}
+
+#endif
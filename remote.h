@@ -0,0 +1,28 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the remote execution protocol: a client that sends compile actions
+    to a worker over a Unix domain socket, and the worker that executes them
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+typedef struct remote_worker_t remote_worker_t;
+
+typedef enum
+{
+    remote_action_executed,
+    remote_action_rejected,
+    remote_connection_lost
+} remote_status_t;
+
+remote_worker_t * connect_to_remote_worker(const char *address);
+size_t get_number_of_remote_worker_slots(remote_worker_t *worker);
+remote_status_t execute_action_remotely(remote_worker_t *worker, string_t *cmd,
+    vector_t *inputs, vector_t *outputs, int *exit_code);
+void disconnect_remote_worker(remote_worker_t *worker);
+void destroy_remote_file_digests();
+int run_remote_worker(const char *address);
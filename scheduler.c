@@ -0,0 +1,683 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the scheduler that executes build actions on local and remote slots
+
+    Every slot is a thread that takes actions from the common queue. Local slots execute
+    any action; remote slots take only actions that declare their inputs and outputs.
+    When a remote worker becomes unavailable, its action returns to the queue and
+    is executed locally.
+
+    With an object cache, cacheable actions wait in a separate queue where cache threads
+    look up their outputs. A hit completes the action, a miss moves it to the common queue.
+    A local slot with nothing to do takes an action whose lookup has not started while
+    all cache threads are busy, so a slow cache never leaves slots idle.
+
+    A local slot takes a token of the make jobserver before executing a command, so
+    factory started by make, and make started by factory, never oversubscribe the machine.
+
+    An action may declare the memory it is expected to use at peak. While other local
+    actions run, it starts only if that fits into free memory minus the expected peaks
+    of the running ones, and only while PSI does not report memory pressure. Free memory
+    and the pressure are read from files, so they are sampled outside the lock at most every
+    MEMORY_SAMPLE_INTERVAL seconds, and actions are admitted by the last sample. The first
+    local action always starts, so a build never stalls. Outputs of executed actions are uploaded in the
+    background.
+
+    An action may depend on other actions, then it waits aside until all of them complete,
+    so a whole target is planned as one graph and slots are never idle at project boundaries.
+    If any of them fails, the action is cancelled and counts as failed. An action that is
+    still completing may add follow-up actions that do the rest of its work; everything
+    that depends on it, or will depend on it later, waits for them too.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "scheduler.h"
+#include "remote.h"
+#include "process.h"
+#include "cache.h"
+#include "jobserver.h"
+#include "memory_usage.h"
+#include "allocator.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_THREADS_COUNT 4
+#define MEMORY_PRESSURE_LIMIT 10.0
+#define MEMORY_SAMPLE_INTERVAL 0.05
+
+typedef struct
+{
+    scheduler_t *scheduler;
+    remote_worker_t *worker;
+    pthread_t thread;
+} slot_t;
+
+typedef struct upload_t upload_t;
+
+struct upload_t
+{
+    uint64_t key;
+    vector_t *files;
+    upload_t *next;
+};
+
+struct scheduler_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t queue_changed;
+    pthread_cond_t all_done;
+    action_t *first;
+    action_t *last;
+    action_t *completed;
+    action_t *lookup_first;
+    action_t *lookup_last;
+    upload_t *uploads;
+    size_t running;
+    size_t blocked;
+    size_t local_running;
+    size_t reserved_memory;
+    size_t available_memory;
+    double memory_sample_time;
+    bool memory_sampling;
+    size_t failed;
+    size_t remote_slots;
+    bool stop;
+    vector_t *slots;
+    object_cache_t *cache;
+    jobserver_t *jobserver;
+    pthread_t cache_threads[CACHE_THREADS_COUNT];
+    size_t cache_threads_count;
+    size_t idle_cache_threads;
+};
+
+action_t * create_action(string_t *cmd, vector_t *inputs, vector_t *outputs)
+{
+    action_t *action = nnalloc(sizeof(action_t));
+    action->cmd = cmd;
+    action->inputs = inputs;
+    action->outputs = outputs;
+    action->log_file = NULL;
+    action->timeout = 0;
+    action->on_completion = NULL;
+    action->context = NULL;
+    action->result = 0;
+    action->timed_out = false;
+    action->duration = 0;
+    action->cacheable = false;
+    action->cache_key = 0;
+    action->expected_memory = 0;
+    action->peak_memory = 0;
+    action->dependents = NULL;
+    action->follow_ups = NULL;
+    action->waiting_for = 0;
+    action->dependency_failed = false;
+    action->submitted = false;
+    action->finished = false;
+    action->next = NULL;
+    return action;
+}
+
+void destroy_action(action_t *action)
+{
+    free(action->cmd);
+    if (action->inputs)
+        destroy_vector_and_content(action->inputs, free);
+    if (action->outputs)
+        destroy_vector_and_content(action->outputs, free);
+    free(action->log_file);
+    if (action->dependents)
+        destroy_vector(action->dependents);
+    if (action->follow_ups)
+        destroy_vector(action->follow_ups);
+    free(action);
+}
+
+/*
+    Called with the lock held, releases it while the files are read; under memory pressure
+    nothing is considered free
+*/
+static void sample_memory(scheduler_t *scheduler)
+{
+    double now = get_current_time();
+    if (scheduler->memory_sampling || now - scheduler->memory_sample_time < MEMORY_SAMPLE_INTERVAL)
+        return;
+    scheduler->memory_sampling = true;
+    pthread_mutex_unlock(&scheduler->mutex);
+    size_t available = get_memory_pressure() >= MEMORY_PRESSURE_LIMIT ? 0 : get_available_memory();
+    pthread_mutex_lock(&scheduler->mutex);
+    if (available > scheduler->available_memory)
+        pthread_cond_broadcast(&scheduler->queue_changed);
+    scheduler->available_memory = available;
+    scheduler->memory_sample_time = get_current_time();
+    scheduler->memory_sampling = false;
+}
+
+static size_t get_memory_budget(scheduler_t *scheduler)
+{
+    if (!scheduler->local_running)
+        return SIZE_MAX;
+    // running actions have not necessarily reached their peaks yet
+    size_t available = scheduler->available_memory;
+    return available > scheduler->reserved_memory ? available - scheduler->reserved_memory : 0;
+}
+
+static action_t * take_action_waiting_for_lookup(scheduler_t *scheduler, size_t memory_budget)
+{
+    action_t *action = scheduler->lookup_first;
+    if (!action || action->expected_memory > memory_budget)
+        return NULL;
+    scheduler->lookup_first = action->next;
+    if (!scheduler->lookup_first)
+        scheduler->lookup_last = NULL;
+    action->next = NULL;
+    scheduler->running++;
+    return action;
+}
+
+static bool is_action_suitable(action_t *action, bool remote_only, size_t memory_budget)
+{
+    if (remote_only)
+        return action->inputs && action->outputs;
+    return action->expected_memory <= memory_budget;
+}
+
+static action_t * take_action(scheduler_t *scheduler, bool remote_only)
+{
+    size_t memory_budget = SIZE_MAX;
+    if (!remote_only && (scheduler->first || scheduler->lookup_first))
+        memory_budget = get_memory_budget(scheduler);
+    action_t *prev = NULL;
+    action_t *action = scheduler->first;
+    while (action && !is_action_suitable(action, remote_only, memory_budget))
+    {
+        prev = action;
+        action = action->next;
+    }
+    if (!action)
+    {
+        if (remote_only || scheduler->idle_cache_threads)
+            return NULL;
+        return take_action_waiting_for_lookup(scheduler, memory_budget);
+    }
+    if (prev)
+        prev->next = action->next;
+    else
+        scheduler->first = action->next;
+    if (scheduler->last == action)
+        scheduler->last = prev;
+    action->next = NULL;
+    scheduler->running++;
+    return action;
+}
+
+/*
+    The memory budget matters only when there is something to start beside running actions
+*/
+static action_t * take_local_action(scheduler_t *scheduler)
+{
+    if (scheduler->local_running && (scheduler->first || scheduler->lookup_first))
+        sample_memory(scheduler);
+    return take_action(scheduler, false);
+}
+
+static bool has_pending_actions(scheduler_t *scheduler)
+{
+    return scheduler->first || scheduler->lookup_first || scheduler->running || scheduler->blocked;
+}
+
+static void append_action_to_queue(scheduler_t *scheduler, action_t *action)
+{
+    action->next = NULL;
+    if (scheduler->last)
+        scheduler->last->next = action;
+    else
+        scheduler->first = action;
+    scheduler->last = action;
+    pthread_cond_broadcast(&scheduler->queue_changed);
+}
+
+static void return_action(scheduler_t *scheduler, action_t *action)
+{
+    scheduler->running--;
+    action->next = scheduler->first;
+    scheduler->first = action;
+    if (!scheduler->last)
+        scheduler->last = action;
+    pthread_cond_broadcast(&scheduler->queue_changed);
+}
+
+static void release_action(scheduler_t *scheduler, action_t *action);
+
+static void complete_action(scheduler_t *scheduler, action_t *action)
+{
+    scheduler->running--;
+    if (action->result != 0)
+        scheduler->failed++;
+    else if (action->cacheable && scheduler->cache)
+    {
+        upload_t *upload = nnalloc(sizeof(upload_t));
+        upload->key = action->cache_key;
+        upload->files = create_vector();
+        for (size_t i = 0; i < action->outputs->size; i++)
+            add_item_to_vector(upload->files, duplicate_string(*((string_t*)action->outputs->data[i])));
+        upload->next = scheduler->uploads;
+        scheduler->uploads = upload;
+        pthread_cond_broadcast(&scheduler->queue_changed);
+    }
+    action->next = scheduler->completed;
+    scheduler->completed = action;
+    action->finished = true;
+    for (size_t i = 0; action->dependents && i < action->dependents->size; i++)
+    {
+        action_t *dependent = (action_t*)action->dependents->data[i];
+        if (action->result != 0)
+            dependent->dependency_failed = true;
+        if (--dependent->waiting_for == 0 && dependent->submitted)
+        {
+            scheduler->blocked--;
+            release_action(scheduler, dependent);
+        }
+    }
+    if (!has_pending_actions(scheduler))
+        pthread_cond_broadcast(&scheduler->all_done);
+}
+
+static void wait_for_local_action(scheduler_t *scheduler)
+{
+    if (!scheduler->first && !scheduler->lookup_first)
+    {
+        pthread_cond_wait(&scheduler->queue_changed, &scheduler->mutex);
+        return;
+    }
+    // there are actions that do not fit into memory now, free memory may grow at any moment
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 100000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&scheduler->queue_changed, &scheduler->mutex, &deadline);
+}
+
+static void * run_local_slot(void *arg)
+{
+    scheduler_t *scheduler = ((slot_t*)arg)->scheduler;
+    pthread_mutex_lock(&scheduler->mutex);
+    while (true)
+    {
+        action_t *action;
+        while (!(action = take_local_action(scheduler)) && !scheduler->stop)
+            wait_for_local_action(scheduler);
+        if (!action)
+            break;
+        scheduler->local_running++;
+        scheduler->reserved_memory += action->expected_memory;
+        pthread_mutex_unlock(&scheduler->mutex);
+        int token = acquire_job_token(scheduler->jobserver);
+        printf("%s\n", action->cmd->data);
+        double start_time = get_current_time();
+        action->result = execute_command_and_measure(action->cmd->data, NULL,
+            action->log_file ? action->log_file->data : NULL, action->timeout, &action->timed_out,
+            &action->peak_memory);
+        action->duration = get_current_time() - start_time;
+        release_job_token(scheduler->jobserver, token);
+        if (action->on_completion)
+            action->on_completion(action);
+        pthread_mutex_lock(&scheduler->mutex);
+        scheduler->local_running--;
+        scheduler->reserved_memory -= action->expected_memory;
+        pthread_cond_broadcast(&scheduler->queue_changed);
+        complete_action(scheduler, action);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return NULL;
+}
+
+static void * run_remote_slot(void *arg)
+{
+    slot_t *slot = (slot_t*)arg;
+    scheduler_t *scheduler = slot->scheduler;
+    pthread_mutex_lock(&scheduler->mutex);
+    while (true)
+    {
+        action_t *action;
+        while (!(action = take_action(scheduler, true)) && !scheduler->stop)
+            pthread_cond_wait(&scheduler->queue_changed, &scheduler->mutex);
+        if (!action)
+            break;
+        pthread_mutex_unlock(&scheduler->mutex);
+        int exit_code;
+        double start_time = get_current_time();
+        remote_status_t status = execute_action_remotely(slot->worker, action->cmd,
+            action->inputs, action->outputs, &exit_code);
+        if (status == remote_action_executed)
+        {
+            printf("%s\n", action->cmd->data);
+            action->result = exit_code;
+            action->duration = get_current_time() - start_time;
+            if (action->on_completion)
+                action->on_completion(action);
+        }
+        pthread_mutex_lock(&scheduler->mutex);
+        if (status == remote_action_executed)
+        {
+            complete_action(scheduler, action);
+            continue;
+        }
+        if (status == remote_action_rejected)
+        {
+            destroy_vector_and_content(action->inputs, free);
+            action->inputs = NULL;
+            return_action(scheduler, action);
+            continue;
+        }
+        return_action(scheduler, action);
+        scheduler->remote_slots--;
+        disconnect_remote_worker(slot->worker);
+        slot->worker = NULL;
+        fprintf(stderr, "A remote worker is unavailable, continue building locally\n");
+        break;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return NULL;
+}
+
+static void * run_cache_thread(void *arg)
+{
+    scheduler_t *scheduler = (scheduler_t*)arg;
+    pthread_mutex_lock(&scheduler->mutex);
+    while (true)
+    {
+        action_t *action = NULL;
+        upload_t *upload = NULL;
+        scheduler->idle_cache_threads++;
+        while (!(action = take_action_waiting_for_lookup(scheduler, SIZE_MAX)) && !(upload = scheduler->uploads)
+                && !scheduler->stop)
+            pthread_cond_wait(&scheduler->queue_changed, &scheduler->mutex);
+        scheduler->idle_cache_threads--;
+        if (action)
+        {
+            pthread_mutex_unlock(&scheduler->mutex);
+            bool hit = download_objects_from_cache(scheduler->cache, action->cache_key, action->outputs);
+            if (hit)
+            {
+                printf("%s (cached)\n", ((string_t*)action->outputs->data[0])->data);
+                action->cacheable = false;
+                if (action->on_completion)
+                    action->on_completion(action);
+            }
+            pthread_mutex_lock(&scheduler->mutex);
+            if (hit)
+            {
+                complete_action(scheduler, action);
+            }
+            else
+            {
+                scheduler->running--;
+                append_action_to_queue(scheduler, action);
+            }
+        }
+        else if (upload)
+        {
+            scheduler->uploads = upload->next;
+            pthread_mutex_unlock(&scheduler->mutex);
+            upload_objects_to_cache(scheduler->cache, upload->key, upload->files);
+            destroy_vector_and_content(upload->files, free);
+            free(upload);
+            pthread_mutex_lock(&scheduler->mutex);
+        }
+        else
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return NULL;
+}
+
+static void start_slot(scheduler_t *scheduler, remote_worker_t *worker)
+{
+    slot_t *slot = nnalloc(sizeof(slot_t));
+    slot->scheduler = scheduler;
+    slot->worker = worker;
+    if (pthread_create(&slot->thread, NULL, worker ? run_remote_slot : run_local_slot, slot) != 0)
+    {
+        if (worker)
+            disconnect_remote_worker(worker);
+        free(slot);
+        return;
+    }
+    if (worker)
+        scheduler->remote_slots++;
+    add_item_to_vector(scheduler->slots, slot);
+}
+
+static void connect_to_remote_workers(scheduler_t *scheduler, const char *remote_workers)
+{
+    string_t *list = duplicate_string(_S(remote_workers));
+    char *address = list->data;
+    while (*address)
+    {
+        char *end = strchr(address, ',');
+        if (end)
+            *end = '\0';
+        if (*address)
+        {
+            remote_worker_t *worker = connect_to_remote_worker(address);
+            if (worker)
+            {
+                size_t slots = get_number_of_remote_worker_slots(worker);
+                start_slot(scheduler, worker);
+                for (size_t i = 1; i < slots; i++)
+                {
+                    worker = connect_to_remote_worker(address);
+                    if (!worker)
+                        break;
+                    start_slot(scheduler, worker);
+                }
+            }
+            else
+            {
+                fprintf(stderr, "The remote worker '%s' is unavailable\n", address);
+            }
+        }
+        if (!end)
+            break;
+        address = end + 1;
+    }
+    free(list);
+}
+
+scheduler_t * create_scheduler(size_t local_slots, const char *remote_workers, const char *object_cache)
+{
+    scheduler_t *scheduler = nnalloc(sizeof(scheduler_t));
+    memset(scheduler, 0, sizeof(scheduler_t));
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->queue_changed, NULL);
+    pthread_cond_init(&scheduler->all_done, NULL);
+    scheduler->slots = create_vector();
+    scheduler->available_memory = get_available_memory();
+    scheduler->memory_sample_time = get_current_time();
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (remote_workers)
+        connect_to_remote_workers(scheduler, remote_workers);
+    if (local_slots == 0)
+        local_slots = 1;
+    scheduler->jobserver = connect_to_jobserver(getenv("MAKEFLAGS"));
+    if (!scheduler->jobserver)
+        scheduler->jobserver = create_jobserver(local_slots);
+    for (size_t i = 0; i < local_slots; i++)
+        start_slot(scheduler, NULL);
+    if (scheduler->remote_slots)
+    {
+        printf("> Using %d local and %d remote slots\n",
+            (int)(scheduler->slots->size - scheduler->remote_slots), (int)scheduler->remote_slots);
+    }
+    if (object_cache)
+        scheduler->cache = connect_to_object_cache(object_cache);
+    if (scheduler->cache)
+    {
+        for (size_t i = 0; i < CACHE_THREADS_COUNT; i++)
+        {
+            if (pthread_create(&scheduler->cache_threads[i], NULL, run_cache_thread, scheduler) != 0)
+                break;
+            scheduler->cache_threads_count++;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return scheduler;
+}
+
+bool scheduler_has_remote_slots(scheduler_t *scheduler)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    bool result = scheduler->remote_slots > 0;
+    pthread_mutex_unlock(&scheduler->mutex);
+    return result;
+}
+
+bool scheduler_has_object_cache(scheduler_t *scheduler)
+{
+    return scheduler->cache_threads_count > 0;
+}
+
+/*
+    A cancelled action is completed as failed without running, which cancels its dependents in turn
+*/
+static void release_action(scheduler_t *scheduler, action_t *action)
+{
+    if (action->dependency_failed)
+    {
+        action->result = -1;
+        action->cacheable = false;
+        scheduler->running++;
+        complete_action(scheduler, action);
+    }
+    else if (action->cacheable && action->outputs && scheduler->cache_threads_count)
+    {
+        action->next = NULL;
+        if (scheduler->lookup_last)
+            scheduler->lookup_last->next = action;
+        else
+            scheduler->lookup_first = action;
+        scheduler->lookup_last = action;
+        pthread_cond_broadcast(&scheduler->queue_changed);
+    }
+    else
+    {
+        action->cacheable = false;
+        append_action_to_queue(scheduler, action);
+    }
+}
+
+void add_action_to_scheduler(scheduler_t *scheduler, action_t *action)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    action->submitted = true;
+    if (action->waiting_for)
+        scheduler->blocked++;
+    else
+        release_action(scheduler, action);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+static void link_actions(action_t *action, action_t *dependency)
+{
+    if (dependency->finished)
+    {
+        if (dependency->result != 0)
+            action->dependency_failed = true;
+    }
+    else
+    {
+        if (!dependency->dependents)
+            dependency->dependents = create_vector();
+        add_item_to_vector(dependency->dependents, action);
+        action->waiting_for++;
+    }
+    for (size_t i = 0; dependency->follow_ups && i < dependency->follow_ups->size; i++)
+        link_actions(action, (action_t*)dependency->follow_ups->data[i]);
+}
+
+/*
+    The dependency may be running or even completed, but the action must not be added yet;
+    completed actions stay valid until 'wait_for_actions'
+*/
+void add_action_dependency(scheduler_t *scheduler, action_t *action, action_t *dependency)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    link_actions(action, dependency);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+/*
+    Called from the completion handler of the predecessor, before it is completed
+*/
+void add_follow_up_action_to_scheduler(scheduler_t *scheduler, action_t *action, action_t *predecessor)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    if (!predecessor->follow_ups)
+        predecessor->follow_ups = create_vector();
+    add_item_to_vector(predecessor->follow_ups, action);
+    for (size_t i = 0; predecessor->dependents && i < predecessor->dependents->size; i++)
+        link_actions((action_t*)predecessor->dependents->data[i], action);
+    action->submitted = true;
+    release_action(scheduler, action);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+bool wait_for_actions(scheduler_t *scheduler)
+{
+    pthread_mutex_lock(&scheduler->mutex);
+    while (has_pending_actions(scheduler))
+        pthread_cond_wait(&scheduler->all_done, &scheduler->mutex);
+    bool result = scheduler->failed == 0;
+    scheduler->failed = 0;
+    action_t *action = scheduler->completed;
+    scheduler->completed = NULL;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    while (action)
+    {
+        action_t *next = action->next;
+        destroy_action(action);
+        action = next;
+    }
+    return result;
+}
+
+void destroy_scheduler(scheduler_t *scheduler)
+{
+    wait_for_actions(scheduler);
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->stop = true;
+    pthread_cond_broadcast(&scheduler->queue_changed);
+    pthread_mutex_unlock(&scheduler->mutex);
+    for (size_t i = 0; i < scheduler->slots->size; i++)
+    {
+        slot_t *slot = (slot_t*)scheduler->slots->data[i];
+        pthread_join(slot->thread, NULL);
+        if (slot->worker)
+            disconnect_remote_worker(slot->worker);
+    }
+    for (size_t i = 0; i < scheduler->cache_threads_count; i++)
+        pthread_join(scheduler->cache_threads[i], NULL);
+    if (scheduler->cache)
+        disconnect_object_cache(scheduler->cache);
+    destroy_jobserver(scheduler->jobserver);
+    destroy_vector_and_content(scheduler->slots, free);
+    destroy_remote_file_digests();
+    pthread_cond_destroy(&scheduler->all_done);
+    pthread_cond_destroy(&scheduler->queue_changed);
+    pthread_mutex_destroy(&scheduler->mutex);
+    free(scheduler);
+}
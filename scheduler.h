@@ -0,0 +1,52 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the scheduler that executes build actions on local and remote slots
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+
+#include <stdint.h>
+
+typedef struct action_t action_t;
+
+struct action_t
+{
+    string_t *cmd;
+    vector_t *inputs;
+    vector_t *outputs;
+    string_t *log_file;
+    double timeout;
+    void (*on_completion)(action_t *action);
+    void *context;
+    int result;
+    bool timed_out;
+    double duration;
+    bool cacheable;
+    uint64_t cache_key;
+    size_t expected_memory;
+    size_t peak_memory;
+    vector_t *dependents;
+    vector_t *follow_ups;
+    size_t waiting_for;
+    bool dependency_failed;
+    bool submitted;
+    bool finished;
+    action_t *next;
+};
+
+typedef struct scheduler_t scheduler_t;
+
+action_t * create_action(string_t *cmd, vector_t *inputs, vector_t *outputs);
+void destroy_action(action_t *action);
+scheduler_t * create_scheduler(size_t local_slots, const char *remote_workers, const char *object_cache);
+bool scheduler_has_remote_slots(scheduler_t *scheduler);
+bool scheduler_has_object_cache(scheduler_t *scheduler);
+void add_action_to_scheduler(scheduler_t *scheduler, action_t *action);
+void add_action_dependency(scheduler_t *scheduler, action_t *action, action_t *dependency);
+void add_follow_up_action_to_scheduler(scheduler_t *scheduler, action_t *action, action_t *predecessor);
+bool wait_for_actions(scheduler_t *scheduler);
+void destroy_scheduler(scheduler_t *scheduler);
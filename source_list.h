@@ -8,6 +8,7 @@
 
 #include "tree_set.h"
 #include "strings.h"
+#include "arena.h"
 
 typedef struct project_descriptor_t project_descriptor_t;
 
@@ -29,7 +30,7 @@ typedef struct
 } source_list_iterator_t;
 
 source_list_t *create_source_list();
-void add_source_to_list(source_list_t *list, project_descriptor_t *project, string_t *c_file, string_t *obj_file);
+void add_source_to_list(source_list_t *list, arena_t *arena, project_descriptor_t *project, string_t *c_file, string_t *obj_file);
 source_list_iterator_t * create_iterator_from_source_list(source_list_t *list);
 bool has_next_source_descriptor(source_list_iterator_t *iter);
 source_descriptor_t * get_next_source_descriptor(source_list_iterator_t *iter);
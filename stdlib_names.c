@@ -6,19 +6,19 @@
 
 #include "stdlib_names.h"
 
-wchar_t *stdlib_names[] = 
+char *stdlib_names[] = 
 {
-    L"threads",
-    L"math",
-    L"sockets"
+    "threads",
+    "math",
+    "sockets"
 };
 
-stdlib_t parse_stdlib_name(const wide_string_t *name)
+stdlib_t parse_stdlib_name(const string_t *name)
 {
     size_t i;
     for (i = 0; i < l_unknown; i++)
     {
-        if (0 == wcscmp(name->data, stdlib_names[i]))
+        if (are_strings_equal(*name, _S(stdlib_names[i])))
             break;
     }
     return (stdlib_t)i;
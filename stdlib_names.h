@@ -16,4 +16,4 @@ typedef enum
     l_unknown
 } stdlib_t;
 
-stdlib_t parse_stdlib_name(const wide_string_t *name);
+stdlib_t parse_stdlib_name(const string_t *name);
@@ -0,0 +1,211 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the per-user store of dependency repositories
+
+    The store keeps one bare mirror per repository URL, in '~/.factory/store' or in the
+    folder given by the FACTORY_STORE environment variable (an empty value disables
+    the store). A dependency is cloned into the mirror once, later it is only fetched,
+    and the folders of workspaces are cloned from the mirror locally, so git hardlinks
+    the objects instead of copying them. The mirror is locked while it is updated,
+    so several builds on one host may share it.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "store.h"
+#include "folders.h"
+#include "path.h"
+#include "hash.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct dependency_store_t
+{
+    string_t *folder;
+};
+
+static string_t * get_dependency_store_folder()
+{
+    const char *folder = getenv("FACTORY_STORE");
+    if (folder)
+        return *folder ? duplicate_string(_S(folder)) : NULL;
+#ifdef _WIN32
+    const char *home = getenv("USERPROFILE");
+#else
+    const char *home = getenv("HOME");
+#endif
+    if (!home || !*home)
+        return NULL;
+    string_t *factory_folder = create_formatted_string("%s%c.factory", home, path_separator);
+    if (!folder_exists(factory_folder->data) && !make_folder(factory_folder->data))
+    {
+        free(factory_folder);
+        return NULL;
+    }
+    string_t *store_folder = create_formatted_string("%S%cstore", *factory_folder, path_separator);
+    free(factory_folder);
+    return store_folder;
+}
+
+dependency_store_t * open_dependency_store()
+{
+    string_t *folder = get_dependency_store_folder();
+    if (!folder)
+        return NULL;
+    if (!folder_exists(folder->data) && !make_folder(folder->data))
+    {
+        fprintf(stderr, "Couldn't create the dependency store '%s', dependencies are cloned directly\n",
+            folder->data);
+        free(folder);
+        return NULL;
+    }
+    dependency_store_t *store = nnalloc(sizeof(dependency_store_t));
+    store->folder = folder;
+    return store;
+}
+
+/*
+    The name of a mirror is the last part of the URL followed by the hash of the whole URL,
+    so the store stays readable and different repositories with the same name do not clash
+*/
+static string_t * create_mirror_path(dependency_store_t *store, string_t *url)
+{
+    size_t end = url->length;
+    while (end > 0 && (url->data[end - 1] == '/' || url->data[end - 1] == '\\'))
+        end--;
+    if (end > 4 && 0 == memcmp(url->data + end - 4, ".git", 4))
+        end -= 4;
+    size_t begin = end;
+    while (begin > 0 && url->data[begin - 1] != '/' && url->data[begin - 1] != '\\' && url->data[begin - 1] != ':')
+        begin--;
+    string_t *name = duplicate_string((string_t){ url->data + begin, end - begin });
+    for (size_t i = 0; i < name->length; i++)
+    {
+        char c = name->data[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_'
+                || c == '.'))
+            name->data[i] = '_';
+    }
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+        (unsigned long long)calculate_hash(initial_hash_value, url->data, url->length));
+    string_t *path = create_formatted_string("%S%c%S-%s.git", *store->folder, path_separator, *name, hash);
+    free(name);
+    return path;
+}
+
+static bool run_git_command(string_t *cmd)
+{
+    printf("%s\n", cmd->data);
+    bool result = system(cmd->data) == 0;
+    free(cmd);
+    return result;
+}
+
+#ifdef _WIN32
+
+typedef int mirror_lock_t;
+
+static mirror_lock_t lock_mirror(string_t *mirror_path)
+{
+    return -1;
+}
+
+static void unlock_mirror(mirror_lock_t lock)
+{
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+
+typedef int mirror_lock_t;
+
+static mirror_lock_t lock_mirror(string_t *mirror_path)
+{
+    string_t *lock_path = create_formatted_string("%S.lock", *mirror_path);
+    int fd = open(lock_path->data, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(lock_path);
+    if (fd < 0)
+        return -1;
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl(fd, F_SETLKW, &lock) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void unlock_mirror(mirror_lock_t lock)
+{
+    if (lock >= 0)
+        close(lock);
+}
+
+#endif
+
+static void remove_folder(string_t *path)
+{
+#ifdef _WIN32
+    string_t *cmd = create_formatted_string("rmdir /s /q \"%S\"", *path);
+#else
+    string_t *cmd = create_formatted_string("rm -rf \"%S\"", *path);
+#endif
+    system(cmd->data);
+    free(cmd);
+}
+
+/*
+    A mirror that already exists is only fetched, a new one is cloned aside and renamed,
+    so an interrupted clone never leaves a broken mirror behind
+*/
+static bool update_mirror(string_t *mirror_path, string_t *url)
+{
+    if (folder_exists(mirror_path->data))
+    {
+        // a stale mirror is still good to start from when the remote is unreachable
+        if (!run_git_command(create_formatted_string("git --git-dir=\"%S\" fetch --prune --quiet", *mirror_path)))
+            fprintf(stderr, "Couldn't update the mirror of '%s', using it as is\n", url->data);
+        return true;
+    }
+    string_t *tmp_path = create_formatted_string("%S.tmp", *mirror_path);
+    if (folder_exists(tmp_path->data))
+        remove_folder(tmp_path);
+    bool result = run_git_command(create_formatted_string("git clone --mirror --quiet \"%S\" \"%S\"", *url, *tmp_path))
+        && rename(tmp_path->data, mirror_path->data) == 0;
+    if (!result)
+        remove_folder(tmp_path);
+    free(tmp_path);
+    return result;
+}
+
+bool clone_from_dependency_store(dependency_store_t *store, string_t *url, string_t *destination)
+{
+    string_t *mirror_path = create_mirror_path(store, url);
+    mirror_lock_t lock = lock_mirror(mirror_path);
+    bool result = update_mirror(mirror_path, url);
+    unlock_mirror(lock);
+    // the checkout tracks the original repository, not the mirror
+    result = result
+        && run_git_command(create_formatted_string("git clone --local --quiet \"%S\" \"%S\"", *mirror_path, *destination))
+        && run_git_command(create_formatted_string("git -C \"%S\" remote set-url origin \"%S\"", *destination, *url));
+    free(mirror_path);
+    return result;
+}
+
+void close_dependency_store(dependency_store_t *store)
+{
+    if (!store)
+        return;
+    free(store->folder);
+    free(store);
+}
@@ -0,0 +1,15 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the per-user store of dependency repositories
+*/
+
+#pragma once
+
+#include "strings.h"
+
+typedef struct dependency_store_t dependency_store_t;
+
+dependency_store_t * open_dependency_store();
+bool clone_from_dependency_store(dependency_store_t *store, string_t *url, string_t *destination);
+void close_dependency_store(dependency_store_t *store);
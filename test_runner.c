@@ -0,0 +1,170 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of the runner that executes test projects in parallel
+
+    Durations of previous runs are kept in a file, and the slowest tests start first,
+    so a test run takes about as long as its longest test. Tests that have never
+    been run are considered the slowest.
+*/
+
+#include "test_runner.h"
+#include "tree_map.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+test_descriptor_t * create_test_descriptor(string_t *name, string_t *exe_file, string_t *log_file, double timeout)
+{
+    test_descriptor_t *test = nnalloc(sizeof(test_descriptor_t));
+    test->name = name;
+    test->exe_file = exe_file;
+    test->log_file = log_file;
+    test->timeout = timeout;
+    test->expected_duration = -1;
+    test->duration = 0;
+    test->result = 0;
+    test->timed_out = false;
+    return test;
+}
+
+void destroy_test_descriptor(test_descriptor_t *test)
+{
+    free(test->name);
+    free(test->exe_file);
+    free(test->log_file);
+    free(test);
+}
+
+static void read_test_durations(vector_t *test_list, string_t *durations_file)
+{
+    FILE *stream = fopen(durations_file->data, "r");
+    if (!stream)
+        return;
+    tree_map_t *tests = create_tree_map((void*)compare_strings);
+    for (size_t i = 0; i < test_list->size; i++)
+    {
+        test_descriptor_t *test = (test_descriptor_t*)test_list->data[i];
+        add_pair_to_tree_map(tests, test->name, test);
+    }
+    char name[256];
+    double duration;
+    while (fscanf(stream, "%255s %lf", name, &duration) == 2)
+    {
+        string_t key = _S(name);
+        const pair_t *pair = get_pair_from_tree_map(tests, &key);
+        if (pair)
+            ((test_descriptor_t*)pair->value)->expected_duration = duration;
+    }
+    destroy_tree_map_and_content(tests, NULL, NULL);
+    fclose(stream);
+}
+
+/*
+    Durations of tests that did not run this time, when only some projects are built,
+    are kept as they were
+*/
+static void write_test_durations(vector_t *test_list, string_t *durations_file)
+{
+    tree_map_t *tests = create_tree_map((void*)compare_strings);
+    for (size_t i = 0; i < test_list->size; i++)
+    {
+        test_descriptor_t *test = (test_descriptor_t*)test_list->data[i];
+        add_pair_to_tree_map(tests, test->name, test);
+    }
+    string_builder_t *other_tests = NULL;
+    FILE *stream = fopen(durations_file->data, "r");
+    if (stream)
+    {
+        char name[256];
+        double duration;
+        while (fscanf(stream, "%255s %lf", name, &duration) == 2)
+        {
+            string_t key = _S(name);
+            if (!get_pair_from_tree_map(tests, &key))
+                other_tests = append_formatted_string(other_tests, "%s %.3f\n", name, duration);
+        }
+        fclose(stream);
+    }
+    destroy_tree_map_and_content(tests, NULL, NULL);
+
+    stream = fopen(durations_file->data, "w");
+    if (stream)
+    {
+        for (size_t i = 0; i < test_list->size; i++)
+        {
+            test_descriptor_t *test = (test_descriptor_t*)test_list->data[i];
+            fprintf(stream, "%s %.3f\n", test->name->data, test->duration);
+        }
+        if (other_tests)
+            fputs(((string_t*)other_tests)->data, stream);
+        fclose(stream);
+    }
+    free(other_tests);
+}
+
+static int compare_tests_by_expected_duration(const void *first, const void *second)
+{
+    const test_descriptor_t *first_test = *((const test_descriptor_t**)first);
+    const test_descriptor_t *second_test = *((const test_descriptor_t**)second);
+    if (first_test->expected_duration < 0 || second_test->expected_duration < 0)
+        return (first_test->expected_duration < 0 ? 0 : 1) - (second_test->expected_duration < 0 ? 0 : 1);
+    if (first_test->expected_duration > second_test->expected_duration)
+        return -1;
+    if (first_test->expected_duration < second_test->expected_duration)
+        return 1;
+    return 0;
+}
+
+static void on_test_completion(action_t *action)
+{
+    test_descriptor_t *test = (test_descriptor_t*)action->context;
+    test->result = action->result;
+    test->timed_out = action->timed_out;
+    test->duration = action->duration;
+}
+
+bool run_tests(scheduler_t *scheduler, vector_t *test_list, string_t *durations_file)
+{
+    size_t count = test_list->size;
+    if (!count)
+        return true;
+    printf("\n> Running %d test(s)...\n", (int)count);
+    read_test_durations(test_list, durations_file);
+    test_descriptor_t **order = nnalloc(sizeof(test_descriptor_t*) * count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = (test_descriptor_t*)test_list->data[i];
+    qsort(order, count, sizeof(test_descriptor_t*), compare_tests_by_expected_duration);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        test_descriptor_t *test = order[i];
+        action_t *action = create_action(duplicate_string(*test->exe_file), NULL, NULL);
+        action->log_file = duplicate_string(*test->log_file);
+        action->timeout = test->timeout;
+        action->on_completion = on_test_completion;
+        action->context = test;
+        add_action_to_scheduler(scheduler, action);
+    }
+    wait_for_actions(scheduler);
+    free(order);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        test_descriptor_t *test = (test_descriptor_t*)test_list->data[i];
+        if (test->timed_out)
+            printf("[TIMEOUT] %s (%.2f s), see '%s'\n", test->name->data, test->duration, test->log_file->data);
+        else if (test->result != 0)
+            printf("[FAILED]  %s (%.2f s), see '%s'\n", test->name->data, test->duration, test->log_file->data);
+        else
+            printf("[OK]      %s (%.2f s)\n", test->name->data, test->duration);
+        if (test->timed_out || test->result != 0)
+            failed++;
+    }
+    write_test_durations(test_list, durations_file);
+    if (failed)
+        printf("%d of %d test(s) failed\n", (int)failed, (int)count);
+    return failed == 0;
+}
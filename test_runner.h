@@ -0,0 +1,27 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of the runner that executes test projects in parallel
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+#include "scheduler.h"
+
+typedef struct
+{
+    string_t *name;
+    string_t *exe_file;
+    string_t *log_file;
+    double timeout;
+    double expected_duration;
+    double duration;
+    int result;
+    bool timed_out;
+} test_descriptor_t;
+
+test_descriptor_t * create_test_descriptor(string_t *name, string_t *exe_file, string_t *log_file, double timeout);
+void destroy_test_descriptor(test_descriptor_t *test);
+bool run_tests(scheduler_t *scheduler, vector_t *test_list, string_t *durations_file);
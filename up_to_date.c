@@ -0,0 +1,271 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Implementation of functions that check whether build results are up to date
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "up_to_date.h"
+#include "file_status.h"
+#include "files.h"
+#include "tree_map.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+bool get_file_modification_time(const char *path, file_time_t *time)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return false;
+#if defined(__linux__)
+    *time = (file_time_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#else
+    *time = (file_time_t)info.st_mtime * 1000000000;
+#endif
+    return true;
+}
+
+/*
+    Dependency files are written by the compiler in the Makefile syntax:
+    'target: first_prerequisite second_prerequisite \'
+    Spaces in file names are escaped by a backslash
+*/
+vector_t * read_dependency_file(const char *dep_file)
+{
+    string_t *content = read_file_to_string(dep_file);
+    if (!content)
+        return NULL;
+    vector_t *list = create_vector();
+    size_t index = 0;
+    while (index < content->length)
+    {
+        char c = content->data[index];
+        if (c == ':' && index + 1 < content->length &&
+                (content->data[index + 1] == ' ' || content->data[index + 1] == '\n' || content->data[index + 1] == '\r'))
+            break;
+        index++;
+    }
+    index++;
+    string_builder_t *item = NULL;
+    while (index < content->length)
+    {
+        char c = content->data[index++];
+        if (c == '\\' && index < content->length)
+        {
+            char next = content->data[index];
+            if (next == '\n' || next == '\r')
+            {
+                index++;
+                continue;
+            }
+            if (next == ' ' || next == '#')
+            {
+                item = append_char(item, next);
+                index++;
+                continue;
+            }
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            if (item)
+            {
+                add_item_to_vector(list, item);
+                item = NULL;
+            }
+            if (c == '\n' && index < content->length && content->data[index] != ' ')
+                break;
+            continue;
+        }
+        item = append_char(item, c);
+    }
+    if (item)
+        add_item_to_vector(list, item);
+    free(content);
+    return list;
+}
+
+string_t * create_dependency_file_name(string_t *obj_file)
+{
+    size_t length = obj_file->length;
+    if (length > 2 && obj_file->data[length - 2] == '.' && obj_file->data[length - 1] == 'o')
+        length -= 2;
+    string_t base = { obj_file->data, length };
+    return create_formatted_string("%S.d", base);
+}
+
+/*
+    Next to the dependency file of an object, or next to a linked file, the hash of the command
+    line that made it is kept, so that a change of options rebuilds it like a change of its inputs
+*/
+static string_t * create_command_hash_file_name(string_t *output_file)
+{
+    size_t length = output_file->length;
+    if (length > 2 && output_file->data[length - 2] == '.' && output_file->data[length - 1] == 'o')
+        length -= 2;
+    string_t base = { output_file->data, length };
+    return create_formatted_string("%S.cmd", base);
+}
+
+bool read_command_hash(string_t *output_file, uint64_t *hash)
+{
+    string_t *file_name = create_command_hash_file_name(output_file);
+    string_t *content = read_file_to_string(file_name->data);
+    free(file_name);
+    if (!content)
+        return false;
+    char *end;
+    *hash = (uint64_t)strtoull(content->data, &end, 16);
+    bool result = end != content->data;
+    free(content);
+    return result;
+}
+
+bool write_command_hash(string_t *output_file, uint64_t hash)
+{
+    string_t *file_name = create_command_hash_file_name(output_file);
+    FILE *stream = fopen(file_name->data, "w");
+    free(file_name);
+    if (!stream)
+        return false;
+    fprintf(stream, "%016llx\n", (unsigned long long)hash);
+    return fclose(stream) == 0;
+}
+
+/*
+    Called before a file is rebuilt, so that an interrupted build does not leave
+    the new file with the hash of the old command line
+*/
+void remove_command_hash(string_t *output_file)
+{
+    string_t *file_name = create_command_hash_file_name(output_file);
+    remove(file_name->data);
+    free(file_name);
+}
+
+/*
+    The files are checked in three passes, so that the metadata of all objects and sources,
+    and then of all their prerequisites, is queried in large batches: the timestamps of
+    objects and sources; the command hashes and the dependency files of objects that are newer
+    than their sources; the timestamps of the prerequisites, each file only once
+*/
+void check_object_files(object_check_t *list, size_t count)
+{
+    file_status_t *statuses = nnalloc(sizeof(file_status_t) * (count ? count * 2 : 1));
+    for (size_t i = 0; i < count; i++)
+    {
+        statuses[i * 2].path = list[i].obj_file->data;
+        statuses[i * 2 + 1].path = list[i].c_file->data;
+    }
+    get_file_statuses(statuses, count * 2);
+
+    vector_t **dependencies = nnalloc(sizeof(vector_t*) * (count ? count : 1));
+    size_t dependencies_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        file_status_t *obj_status = &statuses[i * 2];
+        file_status_t *c_status = &statuses[i * 2 + 1];
+        list[i].up_to_date = false;
+        dependencies[i] = NULL;
+        uint64_t command_hash;
+        if (obj_status->exists && c_status->exists && c_status->time <= obj_status->time
+                && read_command_hash(list[i].obj_file, &command_hash) && command_hash == list[i].command_hash)
+        {
+            dependencies[i] = read_dependency_file(list[i].dep_file->data);
+            if (dependencies[i])
+                dependencies_count += dependencies[i]->size;
+        }
+    }
+
+    file_status_t *dependency_statuses = nnalloc(sizeof(file_status_t) * (dependencies_count ? dependencies_count : 1));
+    tree_map_t *unique_dependencies = create_tree_map((void*)compare_strings);
+    size_t unique_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; dependencies[i] && j < dependencies[i]->size; j++)
+        {
+            string_t *dependency = (string_t*)dependencies[i]->data[j];
+            if (get_pair_from_tree_map(unique_dependencies, dependency))
+                continue;
+            file_status_t *status = &dependency_statuses[unique_count++];
+            status->path = dependency->data;
+            add_pair_to_tree_map(unique_dependencies, dependency, status);
+        }
+    }
+    get_file_statuses(dependency_statuses, unique_count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!dependencies[i])
+            continue;
+        file_time_t obj_time = statuses[i * 2].time;
+        bool result = true;
+        for (size_t j = 0; j < dependencies[i]->size && result; j++)
+        {
+            const pair_t *pair = get_pair_from_tree_map(unique_dependencies, dependencies[i]->data[j]);
+            file_status_t *status = (file_status_t*)pair->value;
+            if (!status->exists || status->time > obj_time)
+                result = false;
+        }
+        list[i].up_to_date = result;
+    }
+
+    destroy_tree_map(unique_dependencies);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (dependencies[i])
+            destroy_vector_and_content(dependencies[i], free);
+    }
+    free(dependency_statuses);
+    free(dependencies);
+    free(statuses);
+}
+
+static void write_escaped_path(FILE *stream, string_t *path)
+{
+    for (size_t i = 0; i < path->length; i++)
+    {
+        char c = path->data[i];
+        if (c == ' ' || c == '#')
+            fputc('\\', stream);
+        fputc(c, stream);
+    }
+}
+
+/*
+    A compiler that runs in another folder writes prerequisites relative to that folder;
+    the file is rewritten relative to the workspace, for the given object file
+*/
+bool rebase_dependency_file(string_t *dep_file, string_t *obj_file, string_t *root_path)
+{
+    vector_t *dependencies = read_dependency_file(dep_file->data);
+    if (!dependencies)
+        return false;
+    FILE *stream = fopen(dep_file->data, "w");
+    if (stream)
+    {
+        write_escaped_path(stream, obj_file);
+        fputc(':', stream);
+        for (size_t i = 0; i < dependencies->size; i++)
+        {
+            string_t *dependency = (string_t*)dependencies->data[i];
+            string_t path = *dependency;
+            if (path.length > root_path->length && 0 == memcmp(path.data, root_path->data, root_path->length))
+            {
+                path.data += root_path->length;
+                path.length -= root_path->length;
+            }
+            fputs(" \\\n ", stream);
+            write_escaped_path(stream, &path);
+        }
+        fputc('\n', stream);
+        fclose(stream);
+    }
+    destroy_vector_and_content(dependencies, free);
+    return stream != NULL;
+}
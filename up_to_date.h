@@ -0,0 +1,31 @@
+/*
+    Copyright (c) 2020 Ivan Kniazkov <ivan.kniazkov.com>
+
+    Definition of functions that check whether build results are up to date
+*/
+
+#pragma once
+
+#include "strings.h"
+#include "vector.h"
+#include <stdint.h>
+
+typedef int64_t file_time_t;
+
+typedef struct
+{
+    string_t *obj_file;
+    string_t *dep_file;
+    string_t *c_file;
+    uint64_t command_hash;
+    bool up_to_date;
+} object_check_t;
+
+bool get_file_modification_time(const char *path, file_time_t *time);
+vector_t * read_dependency_file(const char *dep_file);
+string_t * create_dependency_file_name(string_t *obj_file);
+bool read_command_hash(string_t *output_file, uint64_t *hash);
+bool write_command_hash(string_t *output_file, uint64_t hash);
+void remove_command_hash(string_t *output_file);
+void check_object_files(object_check_t *list, size_t count);
+bool rebase_dependency_file(string_t *dep_file, string_t *obj_file, string_t *root_path);